@@ -0,0 +1,186 @@
+#include "dev.h"
+#include "iface.h"
+#include "kernel_dev.h"
+#include "kv.h"
+#include "loopback.h"
+#include "message.h"
+#include "transaction.h"
+#include "transport/slot.h"
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <rte_eth_ring.h>
+#include <rte_ethdev.h>
+#include <rte_ip.h>
+#include <rte_lcore.h>
+#include <rte_ring.h>
+#include <string>
+#include <utility>
+
+/* Cycles per request of the same request loop, client and server on one
+ * lcore, over dpdk_backend and over the kernel backend. dpdk_backend runs
+ * on two ring PMD ports whose rings are crossed, so what one sends the
+ * other receives; net_null would drop the requests. The kernel backend
+ * uses two UDP sockets on 127.0.0.1, so the difference is what the kernel
+ * path costs on top of the stack.
+ * run e.g. with: --no-pci --no-huge */
+
+static constexpr uint32_t kRequests = 200000;
+static constexpr uint16_t kDepth = 32;
+static constexpr uint16_t kRingSize = 1024;
+
+/* two ring PMD ports, server rx is client tx and the other way around */
+class ring_ports {
+public:
+  ~ring_ports() {
+    for (auto port : {server_port, client_port})
+      if (port != RTE_MAX_ETHPORTS) {
+        rte_eth_dev_stop(port);
+        rte_eth_dev_close(port);
+      }
+    for (auto *ring : rings) {
+      void *pkt;
+      while (ring && !rte_ring_dequeue(ring, &pkt))
+        rte_pktmbuf_free(static_cast<rte_mbuf *>(pkt));
+      rte_ring_free(ring);
+    }
+  }
+
+  bool open(rte_mempool *server_pool, rte_mempool *client_pool) {
+    auto socket = rte_socket_id();
+    rings[0] = rte_ring_create("bb_to_server", kRingSize, socket,
+                               RING_F_SP_ENQ | RING_F_SC_DEQ);
+    rings[1] = rte_ring_create("bb_to_client", kRingSize, socket,
+                               RING_F_SP_ENQ | RING_F_SC_DEQ);
+    if (!rings[0] || !rings[1])
+      return false;
+    return start(server_port, "bb_server", rings[0], rings[1], server_pool) &&
+           start(client_port, "bb_client", rings[1], rings[0], client_pool);
+  }
+
+  uint16_t server_port = RTE_MAX_ETHPORTS, client_port = RTE_MAX_ETHPORTS;
+
+private:
+  static bool start(uint16_t &port, const char *name, rte_ring *rx,
+                    rte_ring *tx, rte_mempool *pool) {
+    auto id = rte_eth_from_rings(name, &rx, 1, &tx, 1, rte_socket_id());
+    if (id < 0)
+      return false;
+    port = id;
+    rte_eth_conf conf{};
+    return !rte_eth_dev_configure(port, 1, 1, &conf) &&
+           !rte_eth_rx_queue_setup(port, 0, kRingSize, rte_socket_id(),
+                                   nullptr, pool) &&
+           !rte_eth_tx_queue_setup(port, 0, kRingSize, rte_socket_id(),
+                                   nullptr) &&
+           !rte_eth_dev_start(port);
+  }
+
+  std::array<rte_ring *, 2> rings{};
+};
+
+struct allocators {
+  explicit allocators(const std::string &name)
+      : server(std::make_shared<message_allocator>((name + "s").c_str(),
+                                                   8191)),
+        client(std::make_shared<message_allocator>((name + "c").c_str(),
+                                                   8191)) {}
+
+  std::shared_ptr<message_allocator> server, client;
+};
+
+/* client and server listen on client_ip and server_ip, the backends were
+ * built with the pools of alloc */
+static double run(const allocators &alloc, std::unique_ptr<dev_backend> sdev,
+                  std::unique_ptr<dev_backend> cdev, uint32_t server_ip,
+                  uint32_t client_ip) {
+  if (!sdev || !cdev)
+    return 0;
+  server_iface server(std::move(sdev),
+                      con_config{rte_cpu_to_be_32(server_ip),
+                                 loopback::kServerPort},
+                      alloc.server);
+  client_iface client(std::move(cdev), alloc.client,
+                      con_config{rte_cpu_to_be_32(client_ip),
+                                 loopback::kClientPort},
+                      rte_lcore_id());
+  auto handler = loopback::echo(alloc.server.get());
+  auto serve = [&] {
+    server.poll(handler);
+    server.complete();
+  };
+
+  auto mac = loopback::kServerMac;
+  auto *con = client.open_connection(
+      {rte_cpu_to_be_32(server_ip), loopback::kServerPort}, mac);
+  if (!con)
+    return 0;
+  while (!client.probe_connection_setup_done(con))
+    serve();
+  con->acknowledge_all();
+  client.flush();
+
+  completion_queue cq(client.get_manager());
+  std::array<completion, kDepth> done;
+  uint32_t submitted = 0, completed = 0;
+  auto start = rte_rdtsc();
+  while (completed < kRequests) {
+    while (submitted < kRequests && cq.outstanding() < kDepth) {
+      auto *req = alloc.client->alloc_message(sizeof(kv_packet<kv_request>));
+      create_get_request(req, submitted);
+      if (!cq.submit(con, req, submitted)) {
+        message_allocator::deallocate(req);
+        break;
+      }
+      ++submitted;
+    }
+    client.flush();
+    serve();
+    auto n = cq.poll_completions(done);
+    for (std::size_t i = 0; i < n; ++i)
+      message_allocator::deallocate(done[i].resp);
+    completed += n;
+  }
+  return static_cast<double>(rte_rdtsc() - start) / kRequests;
+}
+
+int main(int argc, char *argv[]) {
+  if (rte_eal_init(argc, argv) < 0)
+    return -1;
+  if (fastt::init())
+    return -1;
+  auto us = static_cast<double>(rte_get_tsc_hz()) / 1e6;
+  auto report = [&](const char *backend, double cycles) {
+    std::cout << backend << ": " << cycles << " cycles/req "
+              << cycles / us << " us/req" << std::endl;
+  };
+  {
+    allocators alloc("bbdpdk");
+    /* the ports go first, their rings may still hold mbufs of alloc */
+    ring_ports ports;
+    if (!ports.open(alloc.server->mempool(), alloc.client->mempool()))
+      return -1;
+    report("dpdk (net_ring)",
+           run(alloc, std::make_unique<dpdk_backend>(ports.server_port, 0, 0),
+               std::make_unique<dpdk_backend>(ports.client_port, 0, 0),
+               loopback::kServerIp, loopback::kClientIp));
+  }
+  {
+    allocators alloc("bbkernel");
+    auto ip = RTE_IPV4(127, 0, 0, 1);
+    report("kernel",
+           run(alloc,
+               udp_socket_backend::create(rte_cpu_to_be_32(ip),
+                                          loopback::kServerPort,
+                                          alloc.server->mempool()),
+               udp_socket_backend::create(rte_cpu_to_be_32(ip),
+                                          loopback::kClientPort,
+                                          alloc.client->mempool()),
+               ip, ip));
+  }
+  rte_eal_cleanup();
+  return 0;
+}
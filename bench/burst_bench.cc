@@ -0,0 +1,81 @@
+#include "iface.h"
+#include "kv.h"
+#include "loopback.h"
+#include "message.h"
+#include "transaction.h"
+#include "transport/slot.h"
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <span>
+#include <string>
+
+/* Client cycles per request to submit bursts of 1 to 64 requests, one at a
+ * time with submit and at once with submit_burst. Only the submission is
+ * timed, the responses are drained untimed over loopback.
+ * run e.g. with: --no-pci --no-huge */
+
+static constexpr uint32_t kRounds = 5000;
+static constexpr uint16_t kMaxBurst = client_transport::kMaxBurst;
+
+static double run(const char *name, uint16_t burst, bool batched) {
+  loopback lo(name);
+  auto handler = loopback::echo(lo.server_alloc.get());
+  auto *con = lo.connect(handler);
+  if (!con)
+    return 0;
+
+  completion_queue cq(lo.client->get_manager());
+  std::array<submission, kMaxBurst> subs;
+  std::array<completion, kMaxBurst> done;
+  uint64_t cycles = 0, requests = 0;
+  for (uint32_t r = 0; r < kRounds; ++r) {
+    for (uint16_t i = 0; i < burst; ++i) {
+      auto *req = lo.client_alloc->alloc_message(sizeof(kv_packet<kv_request>));
+      create_get_request(req, i);
+      subs[i] = {con, req, i};
+    }
+    /* whatever does not fit the window goes after the next responses */
+    std::size_t sent = 0;
+    while (sent < burst) {
+      auto start = rte_rdtsc();
+      if (batched)
+        sent += cq.submit_burst(std::span(subs).subspan(sent, burst - sent));
+      else
+        while (sent < burst &&
+               cq.submit(subs[sent].con, subs[sent].req, subs[sent].tag))
+          ++sent;
+      cycles += rte_rdtsc() - start;
+      lo.client->flush();
+      lo.server->poll(handler);
+      lo.server->complete();
+      for (auto n = cq.poll_completions(done); n; --n)
+        message_allocator::deallocate(done[n - 1].resp);
+    }
+    while (cq.outstanding()) {
+      lo.server->poll(handler);
+      lo.server->complete();
+      for (auto n = cq.poll_completions(done); n; --n)
+        message_allocator::deallocate(done[n - 1].resp);
+    }
+    requests += burst;
+  }
+  return static_cast<double>(cycles) / requests;
+}
+
+int main(int argc, char *argv[]) {
+  if (rte_eal_init(argc, argv) < 0)
+    return -1;
+  if (fastt::init())
+    return -1;
+  for (uint16_t burst = 1; burst <= kMaxBurst; burst *= 2) {
+    auto single = run(("one" + std::to_string(burst)).c_str(), burst, false);
+    auto batched = run(("bst" + std::to_string(burst)).c_str(), burst, true);
+    std::cout << burst << ": submit " << single << ", submit_burst " << batched
+              << " cycles/req" << std::endl;
+  }
+  rte_eal_cleanup();
+  return 0;
+}
@@ -0,0 +1,84 @@
+#include "connector.h"
+#include "iface.h"
+#include "loopback.h"
+#include "message.h"
+#include "transport/slot.h"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <vector>
+
+/* Time until kConnections client connections to distinct server ports are
+ * up over loopback, opened one after the other and with bulk_connector.
+ * The bulk connects run in waves of kWave, as every FT_INIT holds an mbuf
+ * until it is acked.
+ * run e.g. with: --no-pci --no-huge */
+
+static constexpr uint32_t kConnections = 10000;
+static constexpr uint32_t kWave = 2048;
+
+static std::vector<con_config> targets() {
+  std::vector<con_config> res;
+  for (uint32_t i = 0; i < kConnections; ++i)
+    res.emplace_back(rte_cpu_to_be_32(loopback::kServerIp), 1 + i);
+  return res;
+}
+
+static auto idle = [](server_slot &) {};
+
+static double sequential() {
+  loopback lo("seq");
+  auto mac = loopback::kServerMac;
+  auto start = rte_get_timer_cycles();
+  for (auto &target : targets()) {
+    auto *con = lo.client->open_connection(target, mac);
+    if (!con)
+      return 0;
+    while (!lo.client->probe_connection_setup_done(con)) {
+      lo.server->poll(idle);
+      lo.server->complete();
+    }
+    con->acknowledge_all();
+  }
+  return static_cast<double>(rte_get_timer_cycles() - start) /
+         rte_get_timer_hz();
+}
+
+static double bulk(std::size_t &connected, uint64_t &resent) {
+  loopback lo("bulk");
+  bulk_connector connector(*lo.client);
+  auto all = targets();
+  auto start = rte_get_timer_cycles();
+  for (std::size_t i = 0; i < all.size(); i += kWave) {
+    connector.connect(std::span(all).subspan(
+                          i, std::min<std::size_t>(kWave, all.size() - i)),
+                      loopback::kServerMac);
+    do {
+      lo.server->poll(idle);
+      lo.server->complete();
+    } while (!connector.poll());
+  }
+  auto secs = static_cast<double>(rte_get_timer_cycles() - start) /
+              rte_get_timer_hz();
+  connected = connector.connections().size();
+  resent = connector.resent();
+  return secs;
+}
+
+int main(int argc, char *argv[]) {
+  if (rte_eal_init(argc, argv) < 0)
+    return -1;
+  if (fastt::init())
+    return -1;
+  auto seq = sequential();
+  std::size_t connected;
+  uint64_t resent;
+  auto par = bulk(connected, resent);
+  std::cout << kConnections << " connections: sequential " << seq * 1e3
+            << " ms, bulk " << par * 1e3 << " ms (" << connected
+            << " up, " << resent << " INITs resent)" << std::endl;
+  rte_eal_cleanup();
+  return 0;
+}
@@ -0,0 +1,67 @@
+#include "iface.h"
+#include "kv.h"
+#include "loopback.h"
+#include "message.h"
+#include "task.h"
+#include "transport/slot.h"
+#include <cstdint>
+#include <iostream>
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <string>
+
+/* Cycles per request when 1 to 1024 coroutines each issue kCalls calls one
+ * after the other over loopback. Above the slot count of the connection
+ * the calls wait on the pending list until a slot is free again.
+ * run e.g. with: --no-pci --no-huge */
+
+static constexpr uint32_t kCalls = 200;
+static constexpr uint32_t kMaxTasks = 1024;
+
+static task caller(client_connection *con, message_allocator *allocator,
+                   uint64_t *completed) {
+  for (uint32_t i = 0; i < kCalls; ++i) {
+    auto *req = allocator->alloc_message(sizeof(kv_packet<kv_request>));
+    if (!req)
+      co_return;
+    create_get_request(req, i);
+    if (auto *resp = co_await con->call(req)) {
+      message_allocator::deallocate(resp);
+      ++*completed;
+    }
+  }
+}
+
+static double run(const char *name, uint32_t tasks, uint64_t *completed) {
+  loopback lo(name);
+  auto handler = loopback::echo(lo.server_alloc.get());
+  auto *con = lo.connect(handler);
+  if (!con)
+    return 0;
+
+  client_scheduler scheduler(lo.client->get_manager());
+  auto start = rte_rdtsc();
+  for (uint32_t i = 0; i < tasks; ++i)
+    scheduler.spawn(caller(con, lo.client_alloc.get(), completed));
+  while (scheduler.running()) {
+    scheduler.poll();
+    lo.server->poll(handler);
+    lo.server->complete();
+  }
+  return static_cast<double>(rte_rdtsc() - start) / (tasks * kCalls);
+}
+
+int main(int argc, char *argv[]) {
+  if (rte_eal_init(argc, argv) < 0)
+    return -1;
+  if (fastt::init())
+    return -1;
+  for (uint32_t tasks = 1; tasks <= kMaxTasks; tasks *= 4) {
+    uint64_t completed = 0;
+    auto cycles = run(("co" + std::to_string(tasks)).c_str(), tasks, &completed);
+    std::cout << tasks << " tasks: " << cycles << " cycles/req, " << completed
+              << " of " << tasks * kCalls << " completed" << std::endl;
+  }
+  rte_eal_cleanup();
+  return 0;
+}
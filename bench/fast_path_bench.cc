@@ -0,0 +1,86 @@
+#include "iface.h"
+#include "kv.h"
+#include "loopback.h"
+#include "message.h"
+#include "transaction.h"
+#include "transport/slot.h"
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <vector>
+
+/* Server cycles per single pkt GET with the slot path and with the
+ * slot-less fast path. Client and server share one lcore over loopback,
+ * only the server's poll is timed.
+ * run e.g. with: --no-pci --no-huge */
+
+static constexpr uint32_t kRounds = 20000;
+static constexpr uint16_t kBatch = 32;
+
+struct result {
+  double cycles_per_request;
+  uint64_t pkts;
+};
+
+static result run(const char *name, bool fast_path) {
+  loopback lo(name);
+  auto *allocator = lo.server_alloc.get();
+  auto slot_path = loopback::echo(allocator);
+  auto fast = [&](message *msg) -> message * {
+    return fast_path ? loopback::answer(allocator, msg) : nullptr;
+  };
+  auto *con = lo.connect(slot_path);
+  if (!con)
+    return {};
+
+  kv_proxy kv(lo.client.get(), con);
+  transaction_queue queue{512};
+  std::vector<std::unique_ptr<transaction_proxy>> proxies(kBatch);
+  uint64_t cycles = 0, requests = 0;
+  auto poll_server = [&] {
+    auto start = rte_rdtsc();
+    lo.server->poll(slot_path, fast);
+    lo.server->complete();
+    cycles += rte_rdtsc() - start;
+  };
+  for (uint32_t r = 0; r < kRounds; ++r) {
+    for (uint16_t i = 0; i < kBatch; ++i) {
+      auto *req = lo.client_alloc->alloc_message(sizeof(kv_packet<kv_request>));
+      proxies[i] = kv.start_transaction(con, queue);
+      kv.lookup(i, req);
+      proxies[i]->tx_if().send(req, true);
+    }
+    kv.flush();
+    for (auto &proxy : proxies) {
+      while (!proxy->rx_if().has_incoming_messages()) {
+        poll_server();
+        con->get_manager()->poll_single_connection(con);
+      }
+      message_allocator::deallocate(proxy->rx_if().read());
+      proxy->finish();
+      kv.finish_transaction(proxy.get());
+    }
+    kv.acknowledge();
+    kv.flush();
+    requests += kBatch;
+  }
+  return {static_cast<double>(cycles) / requests,
+          lo.server_dev->frames_sent + lo.client_dev->frames_sent};
+}
+
+int main(int argc, char *argv[]) {
+  if (rte_eal_init(argc, argv) < 0)
+    return -1;
+  if (fastt::init())
+    return -1;
+  auto slot = run("slot", false);
+  auto fast = run("fast", true);
+  std::cout << "slot path: " << slot.cycles_per_request << " cycles/req "
+            << slot.pkts << " pkts" << std::endl;
+  std::cout << "fast path: " << fast.cycles_per_request << " cycles/req "
+            << fast.pkts << " pkts" << std::endl;
+  rte_eal_cleanup();
+  return 0;
+}
@@ -0,0 +1,63 @@
+#include "dev.h"
+#include "iface.h"
+#include "message.h"
+#include "packet_if.h"
+#include "packet_scheduler.h"
+#include "util.h"
+#include <arpa/inet.h>
+#include <cstdint>
+#include <iostream>
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <rte_ether.h>
+
+/* Cycles spent writing the Ethernet/IPv4/UDP headers of a packet, once built
+ * field by field and once copied from a per connection template.
+ * run e.g. with: --no-pci --vdev=net_null0 */
+
+static constexpr uint64_t kIterations = 10'000'000;
+static constexpr uint16_t kPayload = 64;
+
+template <typename F> static double measure(message *msg, F &&write) {
+  auto start = rte_rdtsc();
+  for (uint64_t i = 0; i < kIterations; ++i) {
+    write(msg);
+    msg->shrink_headroom(header_template::kSize);
+  }
+  return static_cast<double>(rte_rdtsc() - start) / kIterations;
+}
+
+static int run() {
+  if (fastt::init())
+    return -1;
+  message_allocator allocator("bench", 1024);
+  netdev dev(0, 0, 0);
+  packet_scheduler scheduler(&dev);
+  packet_if pkt_if(&scheduler, inet_addr("10.0.0.1"), dev.macaddr());
+  con_config target(inet_addr("10.0.0.2"), 5000);
+  rte_ether_addr dmac{{0x02, 0, 0, 0, 0, 0x02}};
+  pkt_if.add_mapping(target.ip, dmac);
+
+  header_template tmpl;
+  if (!pkt_if.build_template(tmpl, 4000, target))
+    return -1;
+  auto *msg = allocator.alloc_message(kPayload);
+
+  auto fields = measure(
+      msg, [&](message *m) { pkt_if.write_headers(m, 4000, target); });
+  auto templ =
+      measure(msg, [&](message *m) { pkt_if.write_headers(m, tmpl); });
+  std::cout << "per field: " << fields << " cycles/pkt" << std::endl;
+  std::cout << "template:  " << templ << " cycles/pkt" << std::endl;
+
+  message_allocator::deallocate(msg);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (rte_eal_init(argc, argv) < 0)
+    return -1;
+  run();
+  rte_eal_cleanup();
+  return 0;
+}
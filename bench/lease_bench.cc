@@ -0,0 +1,188 @@
+#include "iface.h"
+#include "kv.h"
+#include "lease.h"
+#include "loopback.h"
+#include "message.h"
+#include "transaction.h"
+#include "transport/slot.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <rte_mbuf.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* Hit rate and latency of a lease_cache for Zipfian keys, with leases of 0
+ * (no cache), 100 and 1000 us. One in kPutEvery requests is a PUT, which
+ * the server defers until the leases on its key ran out.
+ * run e.g. with: --no-pci --no-huge */
+
+static constexpr uint32_t kKeys = 10000;
+static constexpr double kTheta = 0.99;
+static constexpr uint32_t kRequests = 200000;
+static constexpr uint32_t kPutEvery = 100;
+static constexpr uint16_t kDepth = 32;
+
+/* ranks 0..n-1, rank k drawn with probability proportional to 1/(k+1)^theta */
+class zipf_distribution {
+public:
+  zipf_distribution(uint32_t n, double theta) : cdf(n) {
+    double sum = 0;
+    for (uint32_t k = 0; k < n; ++k)
+      cdf[k] = sum += 1.0 / std::pow(k + 1, theta);
+    for (auto &p : cdf)
+      p /= sum;
+  }
+
+  template <typename R> uint32_t operator()(R &rng) {
+    auto u = std::uniform_real_distribution<double>(0, 1)(rng);
+    return std::min<std::size_t>(
+        std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin(),
+        cdf.size() - 1);
+  }
+
+private:
+  std::vector<double> cdf;
+};
+
+struct result {
+  double hit_rate, get_mean_us, get_p99_us, put_mean_us;
+};
+
+static result run(const char *name, uint32_t lease_us) {
+  loopback lo(name);
+  auto *allocator = lo.server_alloc.get();
+  std::unordered_map<int64_t, int64_t> store;
+  for (uint32_t k = 0; k < kKeys; ++k)
+    store[k] = k;
+  lease_table leases(lease_us);
+  auto respond = [&](server_slot *slot, message *req, int64_t val,
+                     uint32_t lease) {
+    auto *packet = rte_pktmbuf_mtod(req, kv_packet<kv_request> *);
+    auto *resp = allocator->alloc_message(sizeof(kv_packet<kv_completion>));
+    auto *completion = rte_pktmbuf_mtod(resp, kv_packet<kv_completion> *);
+    completion->pt = packet->pt;
+    completion->id = packet->id;
+    completion->payload.reponse = response_t::SUCCESS;
+    completion->payload.val = val;
+    completion->payload.lease_us = lease;
+    slot->tx_if.send(resp, true);
+    if (!slot->has_outstanding_messages())
+      slot->finish();
+    message_allocator::deallocate(req);
+  };
+  auto apply_put = [&](server_slot *slot, message *req) {
+    auto *packet = rte_pktmbuf_mtod(req, kv_packet<kv_request> *);
+    store[packet->payload.key] = packet->payload.val;
+    respond(slot, req, packet->payload.val, 0);
+  };
+  auto handler = [&](server_slot &slot) {
+    auto *msg = slot.rx_if.read();
+    if (!msg)
+      return;
+    auto *packet = rte_pktmbuf_mtod(msg, kv_packet<kv_request> *);
+    int64_t key = packet->payload.key;
+    if (packet->payload.op == request_t::GET)
+      respond(&slot, msg, store[key], leases.grant(key));
+    else if (leases.blocked(key))
+      leases.defer(key, &slot, msg);
+    else
+      apply_put(&slot, msg);
+  };
+  auto *con = lo.connect(handler);
+  if (!con)
+    return {};
+
+  lease_cache cache;
+  kv_proxy kv(lo.client.get(), con, &cache);
+  completion_queue cq(lo.client->get_manager());
+  std::array<completion, kDepth> done;
+  struct request {
+    int64_t key;
+    bool put;
+    uint64_t sent;
+  };
+  std::vector<request> requests(kRequests);
+  std::vector<uint64_t> get_cycles;
+  get_cycles.reserve(kRequests);
+  uint64_t put_cycles = 0, puts = 0;
+  std::mt19937_64 rng(42);
+  zipf_distribution zipf(kKeys, kTheta);
+
+  uint32_t issued = 0, completed = 0;
+  while (completed < kRequests) {
+    while (issued < kRequests && cq.outstanding() < kDepth) {
+      auto &r = requests[issued];
+      r = {zipf(rng), rng() % kPutEvery == 0, rte_get_timer_cycles()};
+      int64_t val;
+      if (!r.put && kv.lookup_cached(r.key, val)) {
+        get_cycles.push_back(rte_get_timer_cycles() - r.sent);
+        ++issued;
+        ++completed;
+        continue;
+      }
+      auto *req =
+          lo.client_alloc->alloc_message(sizeof(kv_packet<kv_request>));
+      if (r.put) {
+        create_put_request(req, r.key, issued);
+        cache.invalidate(r.key);
+      } else
+        kv.lookup(r.key, req);
+      if (!cq.submit(con, req, issued)) {
+        message_allocator::deallocate(req);
+        break;
+      }
+      ++issued;
+    }
+    lo.client->flush();
+    lo.server->poll(handler);
+    leases.release(apply_put);
+    lo.server->complete();
+    auto n = cq.poll_completions(done);
+    auto now = rte_get_timer_cycles();
+    for (std::size_t i = 0; i < n; ++i) {
+      auto &r = requests[done[i].tag];
+      if (r.put) {
+        put_cycles += now - r.sent;
+        ++puts;
+      } else {
+        get_cycles.push_back(now - r.sent);
+        kv.complete_lookup(r.key, done[i].resp, r.sent);
+      }
+      message_allocator::deallocate(done[i].resp);
+    }
+    completed += n;
+  }
+
+  auto us = static_cast<double>(get_ticks_us());
+  std::sort(get_cycles.begin(), get_cycles.end());
+  double sum = 0;
+  for (auto cycles : get_cycles)
+    sum += cycles;
+  auto &stats = cache.get_stats();
+  return {static_cast<double>(stats.hits) / (stats.hits + stats.misses),
+          sum / get_cycles.size() / us,
+          get_cycles[get_cycles.size() * 99 / 100] / us,
+          puts ? put_cycles / us / puts : 0};
+}
+
+int main(int argc, char *argv[]) {
+  if (rte_eal_init(argc, argv) < 0)
+    return -1;
+  if (fastt::init())
+    return -1;
+  for (uint32_t lease_us : {0u, 100u, 1000u}) {
+    auto r = run(("lease" + std::to_string(lease_us)).c_str(), lease_us);
+    std::cout << "lease " << lease_us << " us: hit rate " << r.hit_rate
+              << " GET mean " << r.get_mean_us << " us p99 " << r.get_p99_us
+              << " us PUT mean " << r.put_mean_us << " us" << std::endl;
+  }
+  rte_eal_cleanup();
+  return 0;
+}
@@ -0,0 +1,156 @@
+#pragma once
+
+#include "client.h"
+#include "dev.h"
+#include "iface.h"
+#include "kv.h"
+#include "message.h"
+#include "server.h"
+#include "transport/slot.h"
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_mbuf.h>
+#include <utility>
+
+/* Client and server in one thread, connected by two in-memory queues.
+ * Frames are copied on tx like on a wire, the sender keeps its mbufs for
+ * retransmission. */
+class pipe_backend final : public dev_backend {
+public:
+  pipe_backend(std::deque<rte_mbuf *> *tx, std::deque<rte_mbuf *> *rx,
+               rte_mempool *pool, const rte_ether_addr &mac)
+      : tx(tx), rx(rx), pool(pool), mac(mac) {}
+
+  uint16_t tx_burst(rte_mbuf **pkts, uint16_t cnt) override {
+    for (uint16_t i = 0; i < cnt; ++i) {
+      auto *copy = rte_pktmbuf_alloc(pool);
+      if (copy) {
+        auto *data = rte_pktmbuf_append(copy, pkts[i]->pkt_len);
+        uint32_t off = 0;
+        for (auto *seg = pkts[i]; seg; seg = seg->next) {
+          std::memcpy(data + off, rte_pktmbuf_mtod(seg, void *),
+                      seg->data_len);
+          off += seg->data_len;
+        }
+        tx->push_back(copy);
+        ++frames_sent;
+        bytes_sent += copy->pkt_len;
+      }
+      rte_pktmbuf_free(pkts[i]);
+    }
+    return cnt;
+  }
+
+  uint16_t rx_burst(rte_mbuf **pkts, uint16_t cnt) override {
+    uint16_t n = 0;
+    for (; n < cnt && !rx->empty(); ++n) {
+      pkts[n] = rx->front();
+      rx->pop_front();
+    }
+    return n;
+  }
+
+  void macaddr(rte_ether_addr *addr) override { *addr = mac; }
+
+  /* frames and bytes sent */
+  uint64_t frames_sent = 0, bytes_sent = 0;
+
+private:
+  std::deque<rte_mbuf *> *tx, *rx;
+  rte_mempool *pool;
+  rte_ether_addr mac;
+};
+
+struct loopback {
+  static constexpr uint32_t kServerIp = RTE_IPV4(10, 0, 0, 1);
+  static constexpr uint32_t kClientIp = RTE_IPV4(10, 0, 0, 2);
+  static constexpr uint16_t kServerPort = 5000;
+  static constexpr uint16_t kClientPort = 6000;
+  static constexpr rte_ether_addr kServerMac{{0x02, 0, 0, 0, 0, 0x01}};
+  static constexpr rte_ether_addr kClientMac{{0x02, 0, 0, 0, 0, 0x02}};
+
+  std::shared_ptr<message_allocator> server_alloc, client_alloc;
+  std::deque<rte_mbuf *> to_server, to_client;
+  std::unique_ptr<server_iface> server;
+  std::unique_ptr<client_iface> client;
+  client_connection *con = nullptr;
+  /* owned by server and client */
+  pipe_backend *server_dev, *client_dev;
+
+  explicit loopback(const char *name)
+      : server_alloc(std::make_shared<message_allocator>(
+            (std::string(name) + "s").c_str(), 8191)),
+        client_alloc(std::make_shared<message_allocator>(
+            (std::string(name) + "c").c_str(), 8191)) {
+    auto sdev = std::make_unique<pipe_backend>(
+        &to_client, &to_server, server_alloc->mempool(), kServerMac);
+    auto cdev = std::make_unique<pipe_backend>(
+        &to_server, &to_client, client_alloc->mempool(), kClientMac);
+    server_dev = sdev.get();
+    client_dev = cdev.get();
+    server = std::make_unique<server_iface>(
+        std::move(sdev), con_config{rte_cpu_to_be_32(kServerIp), kServerPort},
+        server_alloc);
+    client = std::make_unique<client_iface>(
+        std::move(cdev), client_alloc, con_config{rte_cpu_to_be_32(kClientIp), kClientPort},
+        rte_lcore_id());
+  }
+
+  ~loopback() {
+    client.reset();
+    server.reset();
+    for (auto *pkt : to_server)
+      rte_pktmbuf_free(pkt);
+    for (auto *pkt : to_client)
+      rte_pktmbuf_free(pkt);
+  }
+
+  /* a SUCCESS completion for the KV request req carrying its key as value */
+  static message *answer(message_allocator *allocator, message *req) {
+    auto *packet = rte_pktmbuf_mtod(req, kv_packet<kv_request> *);
+    auto *resp = allocator->alloc_message(sizeof(kv_packet<kv_completion>));
+    if (!resp)
+      return nullptr;
+    auto *completion = rte_pktmbuf_mtod(resp, kv_packet<kv_completion> *);
+    completion->id = packet->id;
+    completion->pt = packet->pt;
+    completion->payload.reponse = response_t::SUCCESS;
+    completion->payload.val = packet->payload.key;
+    completion->payload.lease_us = 0;
+    return resp;
+  }
+
+  /* server slot handler answering every request with answer */
+  static auto echo(message_allocator *allocator) {
+    return [allocator](server_slot &slot) {
+      auto *msg = slot.rx_if.read();
+      if (!msg)
+        return;
+      if (auto *resp = answer(allocator, msg))
+        slot.tx_if.send(resp, true);
+      if (!slot.has_outstanding_messages())
+        slot.finish();
+      message_allocator::deallocate(msg);
+    };
+  }
+
+  /* polls the server with handler until the client connection is up */
+  template <typename F> client_connection *connect(F &&handler) {
+    auto mac = kServerMac;
+    con = client->open_connection(
+        {rte_cpu_to_be_32(kServerIp), kServerPort}, mac);
+    if (!con)
+      return nullptr;
+    while (!client->probe_connection_setup_done(con)) {
+      server->poll(handler);
+      server->complete();
+    }
+    con->acknowledge_all();
+    client->flush();
+    return con;
+  }
+};
@@ -0,0 +1,96 @@
+#include "iface.h"
+#include "message.h"
+#include "numa.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <string>
+#include <vector>
+
+/* Cycles per operation with pools and per connection state on the socket
+ * of the polling lcore and on a remote socket: mbuf alloc, payload write
+ * and free, and dependent loads over a state array larger than the LLC as
+ * when walking many connections. Runs on the main lcore; needs hugepages
+ * on at least two sockets for the remote numbers.
+ * run e.g. with: -l 0 --no-pci */
+
+static constexpr uint32_t kRounds = 2000;
+static constexpr uint16_t kBatch = 32;
+static constexpr std::size_t kStateSlots = 8 << 20;
+static constexpr uint32_t kLoads = 1 << 22;
+
+static double mbuf_cycles(int socket) {
+  message_allocator allocator(("numa" + std::to_string(socket)).c_str(), 8191,
+                              socket);
+  message *msgs[kBatch];
+  uint64_t cycles = 0;
+  for (uint32_t r = 0; r < kRounds; ++r) {
+    auto start = rte_rdtsc();
+    for (auto &msg : msgs) {
+      msg = allocator.alloc_message(64);
+      std::memset(rte_pktmbuf_mtod(msg, void *), r, 64);
+    }
+    for (auto *msg : msgs)
+      message_allocator::deallocate(msg);
+    cycles += rte_rdtsc() - start;
+  }
+  return static_cast<double>(cycles) / (kRounds * kBatch);
+}
+
+static double state_cycles(int socket) {
+  auto *next = static_cast<uint64_t *>(
+      rte_malloc_socket(nullptr, kStateSlots * sizeof(uint64_t),
+                        RTE_CACHE_LINE_SIZE, socket));
+  if (!next)
+    return 0;
+  /* one random cycle over all slots, so every load misses */
+  std::vector<uint64_t> order(kStateSlots);
+  std::iota(order.begin(), order.end(), 0);
+  std::shuffle(order.begin() + 1, order.end(), std::mt19937_64(42));
+  for (std::size_t i = 0; i < kStateSlots; ++i)
+    next[order[i]] = order[(i + 1) % kStateSlots];
+  uint64_t pos = 0;
+  auto start = rte_rdtsc();
+  for (uint32_t i = 0; i < kLoads; ++i)
+    pos = next[pos];
+  auto cycles = rte_rdtsc() - start;
+  rte_free(next);
+  return static_cast<double>(cycles + (pos & 1)) / kLoads;
+}
+
+static void report(const char *placement, int socket) {
+  std::cout << placement << " (socket " << socket << "): mbuf "
+            << mbuf_cycles(socket) << " cycles/pkt, state "
+            << state_cycles(socket) << " cycles/load" << std::endl;
+}
+
+static int run() {
+  if (fastt::init())
+    return -1;
+  auto local = numa::local_socket();
+  report("local", local);
+  for (unsigned i = 0; i < rte_socket_count(); ++i) {
+    auto socket = rte_socket_id_by_idx(i);
+    if (socket != local) {
+      report("remote", socket);
+      return 0;
+    }
+  }
+  std::cout << "single socket, no remote placement" << std::endl;
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (rte_eal_init(argc, argv) < 0)
+    return -1;
+  run();
+  rte_eal_cleanup();
+  return 0;
+}
@@ -0,0 +1,122 @@
+#include "iface.h"
+#include "kv.h"
+#include "loopback.h"
+#include "message.h"
+#include "remote.h"
+#include "transaction.h"
+#include "transport/slot.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <thread>
+#include <vector>
+
+/* Requests of kProducers plain threads, not lcores, queued through a
+ * submission_ring to the lcore polling a loopback client and server.
+ * Reports the time requests wait in the shared ring, the time completions
+ * wait in the producers' rings and the round trip seen by the producers.
+ * run e.g. with: -l 0 --no-pci --no-huge */
+
+static constexpr uint16_t kProducers = 2;
+static constexpr uint32_t kRequests = 100000;
+static constexpr uint16_t kDepth = 16;
+
+struct producer_result {
+  uint64_t posted_cycles = 0;
+  std::vector<uint64_t> rtt;
+};
+
+static void produce(remote_producer *producer, client_connection *con,
+                    message_allocator *allocator, producer_result *res) {
+  std::vector<uint64_t> started(kDepth);
+  std::vector<uint16_t> free_tags(kDepth);
+  for (uint16_t i = 0; i < kDepth; ++i)
+    free_tags[i] = i;
+  std::array<remote_completion, kDepth> done;
+  uint32_t submitted = 0, completed = 0;
+  res->rtt.reserve(kRequests);
+  while (completed < kRequests) {
+    while (submitted < kRequests && !free_tags.empty()) {
+      auto *req = allocator->alloc_message(sizeof(kv_packet<kv_request>));
+      if (!req)
+        break;
+      create_get_request(req, submitted);
+      auto tag = free_tags.back();
+      started[tag] = rte_rdtsc();
+      if (!producer->submit(con, req, tag)) {
+        message_allocator::deallocate(req);
+        break;
+      }
+      free_tags.pop_back();
+      ++submitted;
+    }
+    auto n = producer->poll(done);
+    auto now = rte_rdtsc();
+    for (std::size_t i = 0; i < n; ++i) {
+      res->posted_cycles += now - done[i].posted;
+      res->rtt.push_back(now - started[done[i].tag]);
+      free_tags.push_back(done[i].tag);
+      message_allocator::deallocate(done[i].resp);
+    }
+    completed += n;
+  }
+}
+
+static double to_ns(double cycles) { return cycles * 1e9 / rte_get_tsc_hz(); }
+
+int main(int argc, char *argv[]) {
+  if (rte_eal_init(argc, argv) < 0)
+    return -1;
+  if (fastt::init())
+    return -1;
+  {
+    loopback lo("remote");
+    auto handler = loopback::echo(lo.server_alloc.get());
+    auto *con = lo.connect(handler);
+    if (!con)
+      return -1;
+    completion_queue cq(lo.client->get_manager());
+    auto ring = submission_ring::create(0, cq, kProducers, SOCKET_ID_ANY);
+    if (!ring)
+      return -1;
+
+    std::vector<producer_result> results(kProducers);
+    std::atomic<uint16_t> running = kProducers;
+    std::vector<std::thread> threads;
+    for (uint16_t i = 0; i < kProducers; ++i)
+      threads.emplace_back([&, i] {
+        produce(ring->producer(i), con, lo.client_alloc.get(), &results[i]);
+        --running;
+      });
+    while (running.load() || cq.outstanding()) {
+      ring->poll();
+      lo.server->poll(handler);
+      lo.server->complete();
+    }
+    for (auto &thread : threads)
+      thread.join();
+
+    auto &stats = ring->get_stats();
+    uint64_t posted = 0;
+    std::vector<uint64_t> rtt;
+    for (auto &res : results) {
+      posted += res.posted_cycles;
+      rtt.insert(rtt.end(), res.rtt.begin(), res.rtt.end());
+    }
+    std::sort(rtt.begin(), rtt.end());
+    std::cout << "submission ring: "
+              << to_ns(static_cast<double>(stats.queued_cycles) /
+                       stats.submitted)
+              << " ns, completion rings: "
+              << to_ns(static_cast<double>(posted) / rtt.size())
+              << " ns, round trip p50 " << to_ns(rtt[rtt.size() / 2])
+              << " ns, p99 " << to_ns(rtt[rtt.size() * 99 / 100]) << " ns"
+              << std::endl;
+  }
+  rte_eal_cleanup();
+  return 0;
+}
@@ -0,0 +1,139 @@
+#include "iface.h"
+#include "kv.h"
+#include "message.h"
+#include "rpc.h"
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <rte_mbuf.h>
+#include <unordered_map>
+#include <vector>
+
+/* Cycles per KV request to decode, serve and encode the response, with the
+ * hand-written casts and switch against rpc::dispatcher. Requests are a
+ * random mix of GET, PUT and DELETE on kKeys keys, built up front; no
+ * network is involved.
+ * run e.g. with: --no-pci --no-huge */
+
+static constexpr uint32_t kKeys = 1024;
+static constexpr uint32_t kRequests = 4096;
+static constexpr uint32_t kRounds = 200;
+
+using kv_store = std::unordered_map<int64_t, int64_t>;
+
+static message *serve_by_hand(kv_store &store, message *msg,
+                              message_allocator *allocator) {
+  auto *packet = rte_pktmbuf_mtod(msg, kv_packet<kv_request> *);
+  auto *resp = allocator->alloc_message(sizeof(kv_packet<kv_completion>));
+  if (!resp)
+    return nullptr;
+  auto *completion = rte_pktmbuf_mtod(resp, kv_packet<kv_completion> *);
+  completion->id = packet->id;
+  completion->pt = packet->pt;
+  completion->payload.reponse = response_t::SUCCESS;
+  completion->payload.val = 0;
+  completion->payload.lease_us = 0;
+  switch (packet->payload.op) {
+  case request_t::GET: {
+    auto it = store.find(packet->payload.key);
+    if (it == store.end())
+      completion->payload.reponse = response_t::FAILURE;
+    else
+      completion->payload.val = it->second;
+    break;
+  }
+  case request_t::PUT:
+    store[packet->payload.key] = packet->payload.val;
+    break;
+  case request_t::DELETE:
+    if (!store.erase(packet->payload.key))
+      completion->payload.reponse = response_t::FAILURE;
+    break;
+  default:
+    completion->payload.reponse = response_t::FAILURE;
+  }
+  return resp;
+}
+
+static void get(kv_store &store, const kv_rpc::request &req,
+                kv_rpc::response &resp) {
+  auto it = store.find(req.payload.key);
+  if (it == store.end())
+    kv_rpc::reply(req, resp, response_t::FAILURE);
+  else
+    kv_rpc::reply(req, resp, response_t::SUCCESS, it->second);
+}
+
+static void put(kv_store &store, const kv_rpc::request &req,
+                kv_rpc::response &resp) {
+  store[req.payload.key] = req.payload.val;
+  kv_rpc::reply(req, resp, response_t::SUCCESS);
+}
+
+static void erase(kv_store &store, const kv_rpc::request &req,
+                  kv_rpc::response &resp) {
+  kv_rpc::reply(req, resp,
+                store.erase(req.payload.key) ? response_t::SUCCESS
+                                             : response_t::FAILURE);
+}
+
+using kv_dispatcher =
+    rpc::dispatcher<kv_rpc, kv_store, rpc::method<request_t::GET, &get>,
+                    rpc::method<request_t::PUT, &put>,
+                    rpc::method<request_t::DELETE, &erase>>;
+
+static_assert(kv_dispatcher::registered(request_t::PUT));
+static_assert(!kv_dispatcher::registered(request_t::WATCH));
+
+template <typename F>
+static double run(message_allocator *allocator,
+                  const std::vector<message *> &requests, F &&serve) {
+  kv_store store;
+  uint64_t cycles = 0;
+  for (uint32_t r = 0; r < kRounds; ++r) {
+    for (auto *req : requests) {
+      auto start = rte_rdtsc();
+      auto *resp = serve(store, req, allocator);
+      cycles += rte_rdtsc() - start;
+      message_allocator::deallocate(resp);
+    }
+  }
+  return static_cast<double>(cycles) / (kRounds * requests.size());
+}
+
+int main(int argc, char *argv[]) {
+  if (rte_eal_init(argc, argv) < 0)
+    return -1;
+  if (fastt::init())
+    return -1;
+  auto allocator = std::make_shared<message_allocator>("rpc", 8191);
+  std::mt19937_64 rng(42);
+  std::vector<message *> requests;
+  for (uint32_t i = 0; i < kRequests; ++i) {
+    auto *req = allocator->alloc_message(sizeof(kv_packet<kv_request>));
+    auto key = static_cast<int64_t>(rng() % kKeys);
+    switch (rng() % 4) {
+    case 0:
+      create_put_request(req, key, i);
+      break;
+    case 1:
+      create_delete_request(req, key);
+      break;
+    default:
+      create_get_request(req, key);
+    }
+    requests.push_back(req);
+  }
+  std::cout << "hand-written: "
+            << run(allocator.get(), requests, serve_by_hand)
+            << " cycles/request" << std::endl;
+  std::cout << "rpc: " << run(allocator.get(), requests, kv_dispatcher::serve)
+            << " cycles/request" << std::endl;
+  for (auto *req : requests)
+    message_allocator::deallocate(req);
+  rte_eal_cleanup();
+  return 0;
+}
@@ -0,0 +1,145 @@
+#include "iface.h"
+#include "kv.h"
+#include "loopback.h"
+#include "message.h"
+#include "sharded_kv.h"
+#include "transport/slot.h"
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <rte_ip.h>
+#include <string>
+#include <vector>
+
+/* Requests per second of sharded_kv_client for 1 to kMaxShards servers
+ * over loopback, with kDepth random GETs in flight. Client and servers
+ * share one lcore, so this shows the client and routing overhead per
+ * shard count rather than server capacity.
+ * run e.g. with: --no-pci --no-huge */
+
+static constexpr uint32_t kRequests = 200000;
+static constexpr uint16_t kDepth = 64;
+static constexpr uint32_t kMaxShards = 8;
+
+/* client side of a loopback with several servers: frames go to the queue
+ * of the server whose address they carry */
+class fanout_backend final : public dev_backend {
+public:
+  fanout_backend(std::vector<std::deque<rte_mbuf *>> *servers,
+                 std::deque<rte_mbuf *> *rx, rte_mempool *pool,
+                 const rte_ether_addr &mac)
+      : servers(servers), rx(rx), pool(pool),
+        out(nullptr, rx, pool, mac) {}
+
+  uint16_t tx_burst(rte_mbuf **pkts, uint16_t cnt) override {
+    for (uint16_t i = 0; i < cnt; ++i) {
+      auto *ip = rte_pktmbuf_mtod_offset(pkts[i], rte_ipv4_hdr *,
+                                         sizeof(rte_ether_hdr));
+      auto idx = (rte_be_to_cpu_32(ip->dst_addr) & 0xff) - 1;
+      pipe_backend(&(*servers)[idx], rx, pool, {}).tx_burst(&pkts[i], 1);
+    }
+    return cnt;
+  }
+
+  uint16_t rx_burst(rte_mbuf **pkts, uint16_t cnt) override {
+    return out.rx_burst(pkts, cnt);
+  }
+
+  void macaddr(rte_ether_addr *addr) override { out.macaddr(addr); }
+
+private:
+  std::vector<std::deque<rte_mbuf *>> *servers;
+  std::deque<rte_mbuf *> *rx;
+  rte_mempool *pool;
+  pipe_backend out;
+};
+
+static double run(uint32_t nshards) {
+  auto name = "shard" + std::to_string(nshards);
+  auto client_alloc =
+      std::make_shared<message_allocator>((name + "c").c_str(), 16383);
+  std::vector<std::shared_ptr<message_allocator>> server_allocs;
+  std::vector<std::deque<rte_mbuf *>> to_servers(nshards);
+  std::deque<rte_mbuf *> to_client;
+  std::vector<std::unique_ptr<server_iface>> servers;
+  for (uint32_t i = 0; i < nshards; ++i) {
+    server_allocs.push_back(std::make_shared<message_allocator>(
+        (name + "s" + std::to_string(i)).c_str(), 8191));
+    rte_ether_addr mac{{0x02, 0, 0, 0, 1, static_cast<uint8_t>(i + 1)}};
+    servers.push_back(std::make_unique<server_iface>(
+        std::make_unique<pipe_backend>(&to_client, &to_servers[i],
+                                       server_allocs[i]->mempool(), mac),
+        con_config{rte_cpu_to_be_32(RTE_IPV4(10, 0, 1, i + 1)),
+                   loopback::kServerPort},
+        server_allocs[i]));
+  }
+  client_iface cif(std::make_unique<fanout_backend>(&to_servers, &to_client,
+                                                    client_alloc->mempool(),
+                                                    loopback::kClientMac),
+                   client_alloc,
+                   con_config{rte_cpu_to_be_32(loopback::kClientIp),
+                              loopback::kClientPort},
+                   rte_lcore_id());
+
+  auto poll_servers = [&] {
+    for (uint32_t i = 0; i < nshards; ++i) {
+      servers[i]->poll(loopback::echo(server_allocs[i].get()));
+      servers[i]->complete();
+    }
+  };
+
+  sharded_kv_client kv(cif, client_alloc.get());
+  for (uint32_t i = 0; i < nshards; ++i) {
+    rte_ether_addr mac{{0x02, 0, 0, 0, 1, static_cast<uint8_t>(i + 1)}};
+    kv.add_server({rte_cpu_to_be_32(RTE_IPV4(10, 0, 1, i + 1)),
+                   loopback::kServerPort},
+                  mac);
+  }
+  std::array<completion, kDepth> done;
+  while (kv.members() < nshards) {
+    poll_servers();
+    kv.poll(done);
+  }
+
+  std::mt19937_64 rng(42);
+  uint32_t submitted = 0, completed = 0;
+  auto start = rte_get_timer_cycles();
+  while (completed < kRequests) {
+    while (submitted < kRequests && kv.outstanding() < kDepth &&
+           kv.get(static_cast<int64_t>(rng()), submitted))
+      ++submitted;
+    cif.flush();
+    poll_servers();
+    auto n = kv.poll(done);
+    for (std::size_t i = 0; i < n; ++i)
+      message_allocator::deallocate(done[i].resp);
+    completed += n;
+  }
+  auto secs = static_cast<double>(rte_get_timer_cycles() - start) /
+              rte_get_timer_hz();
+
+  servers.clear();
+  for (auto &queue : to_servers)
+    for (auto *pkt : queue)
+      rte_pktmbuf_free(pkt);
+  for (auto *pkt : to_client)
+    rte_pktmbuf_free(pkt);
+  return kRequests / secs;
+}
+
+int main(int argc, char *argv[]) {
+  if (rte_eal_init(argc, argv) < 0)
+    return -1;
+  if (fastt::init())
+    return -1;
+  for (uint32_t shards = 1; shards <= kMaxShards; shards *= 2)
+    std::cout << shards << " shards: " << run(shards) << " req/s"
+              << std::endl;
+  rte_eal_cleanup();
+  return 0;
+}
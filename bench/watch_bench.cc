@@ -0,0 +1,178 @@
+#include "iface.h"
+#include "kv.h"
+#include "loopback.h"
+#include "message.h"
+#include "transaction.h"
+#include "transport/slot.h"
+#include "watch.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <rte_eal.h>
+#include <rte_mbuf.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/* Traffic a client needs to follow kKeys keys while kUpdates of them change
+ * per round: GETting every key each round against a WATCH on each, with
+ * the server pushing batched notifications after each round. Counts frames
+ * and bytes in both directions over loopback, acks included.
+ * run e.g. with: --no-pci --no-huge */
+
+static constexpr uint32_t kKeys = 1024;
+static constexpr uint32_t kUpdates = 8;
+static constexpr uint32_t kRounds = 1000;
+static constexpr uint16_t kDepth = 64;
+
+struct traffic {
+  uint64_t pkts = 0, bytes = 0, changes = 0;
+};
+
+static traffic run(const char *name, bool watch) {
+  loopback lo(name);
+  auto *allocator = lo.server_alloc.get();
+  std::unordered_map<int64_t, int64_t> store;
+  watch_table watches(allocator);
+  auto handler = [&](server_slot &slot) {
+    auto *msg = slot.rx_if.read();
+    if (!msg)
+      return;
+    auto *req = rte_pktmbuf_mtod(msg, kv_packet<kv_request> *);
+    auto *resp = allocator->alloc_message(sizeof(kv_packet<kv_completion>));
+    auto *kv_resp = rte_pktmbuf_mtod(resp, kv_packet<kv_completion> *);
+    kv_resp->pt = packet_t::SINGLE;
+    kv_resp->id = req->id;
+    kv_resp->payload.reponse = response_t::SUCCESS;
+    kv_resp->payload.lease_us = 0;
+    switch (req->payload.op) {
+    case request_t::GET:
+      kv_resp->payload.val = store[req->payload.key];
+      break;
+    case request_t::PUT:
+      store[req->payload.key] = req->payload.val;
+      watches.changed(request_t::PUT, req->payload.key, req->payload.val);
+      break;
+    case request_t::WATCH:
+      watches.watch(slot.owner, req->payload.key);
+      kv_resp->payload.val = store[req->payload.key];
+      break;
+    default:
+      kv_resp->payload.reponse = response_t::FAILURE;
+    }
+    slot.tx_if.send(resp, true);
+    if (!slot.has_outstanding_messages())
+      slot.finish();
+    message_allocator::deallocate(msg);
+  };
+  auto *con = lo.connect(handler);
+  if (!con)
+    return {};
+
+  completion_queue cq(lo.client->get_manager());
+  std::array<completion, kDepth> done;
+  std::vector<int64_t> cache(kKeys);
+  traffic t;
+  auto serve = [&] {
+    lo.server->poll(handler);
+    lo.server->complete();
+  };
+  /* sends op for every key, returns once all completed */
+  auto for_all_keys = [&](request_t op) {
+    uint32_t submitted = 0, completed = 0;
+    while (completed < kKeys) {
+      while (submitted < kKeys && cq.outstanding() < kDepth) {
+        auto *req =
+            lo.client_alloc->alloc_message(sizeof(kv_packet<kv_request>));
+        if (op == request_t::WATCH)
+          create_watch_request(req, submitted);
+        else
+          create_get_request(req, submitted);
+        if (!cq.submit(con, req, submitted)) {
+          message_allocator::deallocate(req);
+          break;
+        }
+        ++submitted;
+      }
+      lo.client->flush();
+      serve();
+      auto n = cq.poll_completions(done);
+      for (std::size_t i = 0; i < n; ++i) {
+        if (done[i].tag != completion_queue::kPushTag) {
+          auto *kv_resp =
+              rte_pktmbuf_mtod(done[i].resp, kv_packet<kv_completion> *);
+          int64_t val = kv_resp->payload.val;
+          if (std::exchange(cache[done[i].tag], val) != val)
+            ++t.changes;
+          ++completed;
+        }
+        message_allocator::deallocate(done[i].resp);
+      }
+    }
+  };
+  if (watch)
+    for_all_keys(request_t::WATCH);
+
+  std::mt19937_64 rng(42);
+  uint64_t pushed = 0;
+  auto pkts = lo.server_dev->frames_sent + lo.client_dev->frames_sent;
+  auto bytes = lo.server_dev->bytes_sent + lo.client_dev->bytes_sent;
+  for (uint32_t r = 0; r < kRounds; ++r) {
+    for (uint32_t i = 0; i < kUpdates; ++i) {
+      auto key = static_cast<int64_t>(rng() % kKeys);
+      auto val = static_cast<int64_t>(r * kUpdates + i + 1);
+      store[key] = val;
+      watches.changed(request_t::PUT, key, val);
+    }
+    if (!watch) {
+      for_all_keys(request_t::GET);
+      continue;
+    }
+    watches.flush();
+    auto expected = watches.get_stats().notifications;
+    while (pushed < expected) {
+      serve();
+      watches.flush();
+      auto n = cq.poll_completions(done);
+      for (std::size_t i = 0; i < n; ++i) {
+        auto *batch =
+            rte_pktmbuf_mtod(done[i].resp, kv_batch<kv_notification> *);
+        for (uint32_t k = 0; k < batch->elems; ++k) {
+          int64_t key = batch->elements[k].key, val = batch->elements[k].val;
+          if (std::exchange(cache[key], val) != val)
+            ++t.changes;
+        }
+        pushed += batch->elems;
+        message_allocator::deallocate(done[i].resp);
+      }
+    }
+  }
+  t.pkts = lo.server_dev->frames_sent + lo.client_dev->frames_sent - pkts;
+  t.bytes = lo.server_dev->bytes_sent + lo.client_dev->bytes_sent - bytes;
+  return t;
+}
+
+int main(int argc, char *argv[]) {
+  if (rte_eal_init(argc, argv) < 0)
+    return -1;
+  if (fastt::init())
+    return -1;
+  auto report = [](const char *mode, const traffic &t) {
+    std::cout << mode << ": " << static_cast<double>(t.pkts) / kRounds
+              << " pkts/round " << static_cast<double>(t.bytes) / kRounds
+              << " bytes/round " << t.changes << " changes seen"
+              << std::endl;
+  };
+  auto polled = run("wpoll", false);
+  auto watched = run("wpush", true);
+  report("poll", polled);
+  report("watch", watched);
+  std::cout << "watch saves "
+            << 100.0 - 100.0 * watched.bytes /
+                           std::max<uint64_t>(polled.bytes, 1)
+            << "% of the bytes" << std::endl;
+  rte_eal_cleanup();
+  return 0;
+}
@@ -0,0 +1,83 @@
+#include "iface.h"
+#include "message.h"
+#include "transport/bitmap.h"
+#include "transport/window.h"
+#include <cstdint>
+#include <iostream>
+#include <rte_cycles.h>
+#include <rte_eal.h>
+#include <vector>
+
+/* Cycles per packet of the receive window and SACK bitmap operations for
+ * window sizes from 128 to 4096 packets. Every kHoleStride-th packet is
+ * missing in the first pass and filled in afterwards.
+ * run e.g. with: --no-pci --no-huge */
+
+static constexpr uint32_t kRounds = 2000;
+static constexpr uint32_t kHoleStride = 8;
+
+struct result {
+  uint64_t set = 0, copy = 0, sack = 0, advance = 0;
+};
+
+template <uint32_t N>
+static void run_window(std::vector<message *> &msgs) {
+  window<N> wd(1);
+  uint64_t words[window<N>::kWords];
+  result res;
+  uint64_t sink = 0;
+  for (uint32_t r = 0; r < kRounds; ++r) {
+    auto base = wd.least_in_window;
+    auto start = rte_rdtsc();
+    for (uint32_t i = 0; i < N; ++i)
+      if (i % kHoleStride)
+        wd.set(base + i, msgs[i]);
+    res.set += rte_rdtsc() - start;
+
+    start = rte_rdtsc();
+    auto len = wd.copy_words(words);
+    res.copy += rte_rdtsc() - start;
+
+    start = rte_rdtsc();
+    bitmap::for_each_zero(words, len, [&](uint32_t i) { sink += i; });
+    sink += bitmap::highest_set(words, 0, len);
+    res.sack += rte_rdtsc() - start;
+
+    for (uint32_t i = 0; i < N; i += kHoleStride)
+      wd.set(base + i, msgs[i]);
+    start = rte_rdtsc();
+    wd.advance([&](message *msg) { sink += reinterpret_cast<uintptr_t>(msg); });
+    res.advance += rte_rdtsc() - start;
+  }
+  double pkts = static_cast<double>(kRounds) * N;
+  std::cout << N << ": set " << res.set / pkts << ", copy " << res.copy / pkts
+            << ", sack " << res.sack / pkts << ", advance "
+            << res.advance / pkts << " cycles/pkt (" << (sink & 1) << ")"
+            << std::endl;
+}
+
+static int run() {
+  if (fastt::init())
+    return -1;
+  message_allocator allocator("bench", 8191);
+  std::vector<message *> msgs(4096);
+  for (auto &msg : msgs)
+    msg = allocator.alloc_message(0);
+  run_window<128>(msgs);
+  run_window<256>(msgs);
+  run_window<512>(msgs);
+  run_window<1024>(msgs);
+  run_window<2048>(msgs);
+  run_window<4096>(msgs);
+  for (auto *msg : msgs)
+    message_allocator::deallocate(msg);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (rte_eal_init(argc, argv) < 0)
+    return -1;
+  run();
+  rte_eal_cleanup();
+  return 0;
+}
@@ -1,9 +1,12 @@
 #include "client.h"
 #include "iface.h"
+#include "kernel_dev.h"
 #include "kv.h"
 #include "message.h"
+#include "shm_dev.h"
 #include "transaction.h"
 #include <arpa/inet.h>
+#include <array>
 #include <atomic>
 #include <bits/getopt_core.h>
 #include <cassert>
@@ -36,11 +39,13 @@ struct netconfig {
   uint32_t sip, dip;
   uint16_t dport;
   std::vector<uint16_t> sports;
+  bool kernel = false;
+  bool shm = false;
 };
 
 struct lcore_adapter {
   std::vector<std::unique_ptr<client_iface>> cifs;
-  std::vector<connection *> connections;
+  std::vector<client_connection *> connections;
   std::vector<std::shared_ptr<message_allocator>> allocator;
 
   lcore_adapter(std::size_t n)
@@ -54,7 +59,8 @@ static netconfig parse_cmdline(int argc, char *argv[]) {
   static const struct option long_options[] = {
       {"dip", required_argument, 0, 0},   {"sip", required_argument, 0, 0},
       {"dmac", required_argument, 0, 0},  {"sport", required_argument, 0, 0},
-      {"dport", required_argument, 0, 0}, {0, 0, 0, 0}};
+      {"dport", required_argument, 0, 0}, {"backend", required_argument, 0, 0},
+      {"shm", no_argument, 0, 0},         {0, 0, 0, 0}};
   while ((opt = getopt_long(argc, argv, "", long_options, &option_index)) !=
          -1) {
     switch (option_index) {
@@ -79,6 +85,12 @@ static netconfig parse_cmdline(int argc, char *argv[]) {
     case 4:
       conf.dport = atoi(optarg);
       break;
+    case 5:
+      conf.kernel = std::string_view(optarg) == "kernel";
+      break;
+    case 6:
+      conf.shm = true;
+      break;
     }
   }
   return conf;
@@ -87,42 +99,35 @@ static netconfig parse_cmdline(int argc, char *argv[]) {
 static constexpr auto dur = 10000;
 static constexpr uint16_t dataSize = sizeof(kv_packet<kv_request>);
 static constexpr uint16_t cnt = 32;
-struct msg_context {
-  message *req;
-  std::unique_ptr<transaction_proxy> resp = nullptr;
-};
 static int lcore_fn(void *arg) {
   std::random_device dev;
   std::mt19937 rng(dev());
   std::uniform_int_distribution<std::mt19937::result_type> dist(INT64_MIN,
                                                                 INT64_MAX);
   auto *adapter = static_cast<lcore_adapter *>(arg);
-  transaction_queue queue{512};
   auto me = rte_lcore_index(rte_lcore_id());
   auto *con = adapter->connections[me];
   auto &allocator = adapter->allocator[me];
   auto &cif = *adapter->cifs[me];
   auto pkts = 0;
   uint64_t now = rte_get_timer_cycles();
-  std::vector<msg_context> ctx(cnt);
+  completion_queue cq(cif.get_manager());
+  cq.enable_stale_filter({kv_stamp_generation, kv_has_generation});
+  std::array<completion, cnt> done;
 
   kv_proxy kv(&cif, con);
   while (pkts < dur) {
-    for (auto &c : ctx) {
-      c.req = allocator->alloc_message(dataSize);
-      c.resp = kv.start_transaction(con, queue);
-      assert(c.resp.get());
-      kv.lookup(dist(rng), c.req);
-      c.resp->tx_if().send(c.req, true);
+    for (uint16_t i = 0; i < cnt; ++i) {
+      auto *req = allocator->alloc_message(dataSize);
+      kv.lookup(dist(rng), req);
+      [[maybe_unused]] bool submitted = cq.submit(con, req, i);
+      assert(submitted);
     }
-    for (auto &c : ctx) {
-      c.resp->wait();
-      auto *msg = c.resp->rx_if().read();
-      if (c.resp->finish()) {
-        allocator->deallocate(msg);
-        kv.finish_transaction(c.resp.get());
-      }
-      assert(c.resp->completed());
+    for (uint16_t left = cnt; left;) {
+      auto n = cq.poll_completions(done);
+      for (std::size_t i = 0; i < n; ++i)
+        allocator->deallocate(done[i].resp);
+      left -= n;
     }
     kv.acknowledge();
     ++pkts;
@@ -144,33 +149,55 @@ int run(netconfig &conf) {
   if (fastt::init())
     return -1;
   auto cnt = rte_lcore_count();
-  auto ifc = iface::configure_port(0, cnt, cnt);
-  if (!ifc)
-    return -1;
+  std::unique_ptr<iface> ifc;
+  if (!conf.kernel) {
+    ifc = iface::configure_port(0, cnt, cnt);
+    if (!ifc)
+      return -1;
+  }
 
   uint16_t i = 0;
   uint16_t lcore;
   lcore_adapter adpater(rte_lcore_count());
   RTE_LCORE_FOREACH(lcore) {
-    auto [port, txq, rxq, pool] = ifc->get_slice(i);
     adpater.allocator[i] = std::make_shared<message_allocator>(
-        ("mpool" + std::to_string(i)).c_str(), 8095);
+        ("mpool" + std::to_string(i)).c_str(), 8095,
+        rte_lcore_to_socket_id(lcore));
+    std::unique_ptr<dev_backend> backend;
+    if (conf.kernel) {
+      backend = udp_socket_backend::create(conf.sip, conf.sports[i],
+                                           adpater.allocator[i]->mempool());
+    } else {
+      auto [port, txq, rxq, pool] = ifc->get_slice(i);
+      backend = std::make_unique<dpdk_backend>(port, txq, rxq);
+    }
+    if (backend && conf.shm)
+      backend = shm_backend::create(std::move(backend), conf.sip,
+                                    conf.sports[i],
+                                    adpater.allocator[i]->mempool());
+    if (!backend)
+      return -1;
     adpater.cifs[i] = std::make_unique<client_iface>(
-        port, txq, rxq, adpater.allocator[i],
+        std::move(backend), adpater.allocator[i],
         con_config{conf.sip, conf.sports[i]}, lcore);
-    auto &cif = adpater.cifs[i];
-    auto *con = cif->open_connection({conf.dip, conf.dport}, conf.dmac);
+    auto *con = adpater.cifs[i]->open_connection({conf.dip, conf.dport},
+                                                 conf.dmac);
     if (!con)
       return -1;
-    while (!cif->probe_connection_setup_done(con))
-      ;
-    con->acknowledge_all();
     adpater.connections[i] = con;
     ++i;
   }
+  /* all INITs are out, the handshakes run in parallel */
+  for (i = 0; i < adpater.cifs.size(); ++i) {
+    auto *con = adpater.connections[i];
+    while (!adpater.cifs[i]->probe_connection_setup_done(con))
+      ;
+    con->acknowledge_all();
+  }
   run(lcore_fn, &adpater);
 
-  ifc->stop();
+  if (ifc)
+    ifc->stop();
   std::cout << "avg: " << lat.load() / rte_lcore_count() << std::endl;
   return 0;
 }
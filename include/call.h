@@ -0,0 +1,66 @@
+#pragma once
+
+#include "message.h"
+#include "util.h"
+#include <coroutine>
+#include <rte_mbuf.h>
+#include <type_traits>
+#include <utility>
+
+/* A call that found no free slot or no send window waits on the pending
+ * list of its lcore, client_scheduler retries all of them after every
+ * poll and keeps the ones that are still blocked in order. */
+struct pending_call {
+  list_hook link;
+  bool (*retry)(pending_call *);
+};
+
+__inline intrusive_list_t<pending_call> &pending_calls() {
+  static thread_local intrusive_list_t<pending_call> calls;
+  return calls;
+}
+
+/* Awaiter of basic_connection::call. It lives in the frame of the awaiting
+ * coroutine, so a call allocates nothing. The slot remembers the coroutine
+ * and the manager's poll resumes it once the response is complete. */
+template <typename C> class call_awaiter : pending_call {
+  using slot_t = std::remove_pointer_t<
+      decltype(std::declval<C &>().start_transaction())>;
+
+public:
+  call_awaiter(C *con, message *req)
+      : pending_call{{}, retry_cb}, con(con), req(req) {}
+
+  bool await_ready() const noexcept { return false; }
+
+  void await_suspend(std::coroutine_handle<> h) {
+    waiter = h;
+    if (!start())
+      pending_calls().push_back(*this);
+  }
+
+  /* the response, the pkts of a multi pkt response are chained; nullptr
+   * if they do not fit one chain */
+  message *await_resume() {
+    auto *resp = slot->rx_if.read_all();
+    con->finish_transaction(slot);
+    return resp;
+  }
+
+private:
+  static bool retry_cb(pending_call *call) {
+    return static_cast<call_awaiter *>(call)->start();
+  }
+
+  bool start() {
+    if (!slot && !(slot = con->start_transaction()))
+      return false;
+    slot->waiter = waiter;
+    return slot->tx_if.send(req, true);
+  }
+
+  C *con;
+  message *req;
+  slot_t *slot = nullptr;
+  std::coroutine_handle<> waiter;
+};
@@ -18,21 +18,32 @@ public:
                std::shared_ptr<message_allocator> pool,
                const con_config &scon_config, uint16_t lcore_id)
       : scon_config(scon_config),
-        manager(true, port, txq, rxq, scon_config.ip, pool, lcore_id) {}
+        manager(port, txq, rxq, scon_config.ip, pool, lcore_id) {}
+  client_iface(std::unique_ptr<dev_backend> backend,
+               std::shared_ptr<message_allocator> pool,
+               const con_config &scon_config, uint16_t lcore_id)
+      : scon_config(scon_config), manager(std::move(backend),
+                                          scon_config.ip, pool, lcore_id) {}
 
-  template <bool flush = true> bool probe_connection_setup_done(connection *con) {
+  template <bool flush = true> bool probe_connection_setup_done(client_connection *con) {
     manager.fetch_from_device();  
     if constexpr (flush)
       manager.flush();
     return con->active();
   }
 
-  message *recv_message(connection *con);
-  connection *open_connection(const con_config &target, rte_ether_addr &dmac);
+  message *recv_message(client_connection *con);
+  /* with flush false the FT_INIT may wait for the next flush, see
+   * bulk_connector */
+  client_connection *open_connection(const con_config &target,
+                                     rte_ether_addr &dmac, bool flush = true);
 
   void flush() { manager.flush(); }
 
+  /* for a client_scheduler driving this iface */
+  client_connection_manager &get_manager() { return manager; }
+
 private:
   con_config scon_config;
-  connection_manager manager;
+  client_connection_manager manager;
 };
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <generic/rte_cycles.h>
 #include <memory.h>
@@ -11,44 +13,74 @@
 #include <rte_log.h>
 #include <rte_mbuf.h>
 #include <rte_mbuf_core.h>
+#include <rte_ring.h>
 #include <rte_udp.h>
+#include <utility>
 
+#include "call.h"
 #include "debug.h"
 #include "dev.h"
 #include "message.h"
+#include "numa.h"
 #include "packet_if.h"
 #include "protocol.h"
+#include "restart.h"
 #include "timer.h"
+#include "transport/policy.h"
 #include "transport/slot.h"
 #include "transport/transport.h"
 #include "util.h"
 
 class iface;
-class connection_manager;
+template <typename P> class basic_connection_manager;
 
-class connection {
+/* P is a transport_policy, see client_connection and server_connection.
+ * Connections, their transport and slots live on the socket of the manager
+ * that creates them. */
+template <typename P> class basic_connection : public numa::placed {
+  using transport = basic_transport<P>;
+  using transaction_slot = basic_transaction_slot<P>;
+  using connection_manager = basic_connection_manager<P>;
   static constexpr uint16_t kMaxTransactionPerConnection =
       transport::kOustandingMessages;
+  static constexpr uint16_t kMaxPushTids = transport::kMaxPushTids;
+  /* a cancelled slot waits at most this long for its late response */
+  static constexpr uint64_t kCancelTimeoutMs = 100;
 
 public:
-  connection(message_allocator *allocator, packet_if *pkt_if,
-             const con_config &target, uint16_t sport,
-             connection_manager *manager, bool is_client)
-      : allocator(allocator), transport_impl(std::make_unique<transport>(
-                                  allocator, pkt_if, sport, target)),
-        manager(manager) {
-    slots.reserve(kMaxTransactionPerConnection);
+  basic_connection(message_allocator *allocator, packet_if *pkt_if,
+                   const con_config &target, uint16_t sport,
+                   connection_manager *manager)
+      : allocator(allocator),
+        transport_impl(new (manager->get_socket())
+                           transport(allocator, pkt_if, sport, target)),
+        slots(numa::allocator<transaction_slot>(manager->get_socket())),
+        manager(manager), push_timer(timertype::SINGLE) {
+    slots.reserve(kMaxTransactionPerConnection + kMaxPushTids);
     for (uint16_t i = 0; i < kMaxTransactionPerConnection; ++i) {
-      slots.emplace_back(i, transport_impl.get(), is_client);
-      if (is_client)
+      slots.emplace_back(i, transport_impl.get(), this);
+      if constexpr (P::is_client)
         free_slots.push_back(i);
     }
+    /* pushes of the server land on slots of their own, which are never
+     * started and stay completed */
+    if constexpr (P::is_client)
+      for (uint16_t i = 0; i < kMaxPushTids; ++i)
+        slots.emplace_back(transport::kPushTidBase + i, transport_impl.get(),
+                           this);
   }
-  void process_pkt(rte_mbuf *pkt);
-  void acknowledge_all();
-  void accept();
-  uint16_t receive_message(message **msgs, uint16_t cnt);
-  void open_connection();
+
+  void process_pkt(rte_mbuf *pkt) {
+    transport_impl->process_pkt(static_cast<message *>(pkt));
+  }
+
+  void acknowledge_all() { transport_impl->acknowledge(); }
+
+  void accept() { transport_impl->accept_connection(); }
+
+  void open_connection() { transport_impl->open_connection(); }
+
+  bool retry_handshake() { return transport_impl->retry_handshake(); }
 
   statistics get_transport_stats() const { return transport_impl->get_stats(); }
 
@@ -56,29 +88,89 @@ public:
 
   intrusive_list_t<transaction_slot> &get_inprogress() { return inprogress; }
 
-  void process_incoming_server() {
-    transport_impl->receive_messages([&](message *msg) {
-      auto *hdr = rte_pktmbuf_mtod(msg, protocol::ft_header *);
-      FASTT_LOG_DEBUG("Got new data for slot %u\n", hdr->msg_id);
-      slots[hdr->msg_id].update_execution_state(inprogress);
-      slots[hdr->msg_id].handle_incoming_server(msg, hdr->fini);
-      msg->shrink_headroom(sizeof(protocol::ft_header));
-      FASTT_LOG_DEBUG("Got message of size %u\n", msg->pkt_len);
-    });
+  void process_incoming() {
+    if constexpr (P::is_client) {
+      transport_impl->receive_messages([&](message *msg) {
+        auto *hdr = rte_pktmbuf_mtod(msg, protocol::ft_header *);
+        FASTT_LOG_DEBUG("Got new data for slot %u\n", hdr->msg_id);
+        if (hdr->msg_id >= slots.size()) {
+          rte_pktmbuf_free(msg);
+          return;
+        }
+        auto &slot = slots[hdr->msg_id];
+        /* late response of a request given up on, its slot is free */
+        if (slot.stale && !slot.in_use) {
+          if (hdr->fini)
+            slot.stale = false;
+          rte_pktmbuf_free(msg);
+          return;
+        }
+        slot.handle_incoming(msg, hdr->fini);
+        msg->shrink_headroom(sizeof(protocol::ft_header));
+        FASTT_LOG_DEBUG("Got message of size %u\n", msg->pkt_len);
+        /* complete responses are handed out by the manager's poll, the
+         * late ones of cancelled slots only free the slot */
+        if (slot.completed() && slot.cancelled)
+          recycle(&slot);
+        else if (slot.completed() && !slot.ready_link.is_linked())
+          ready_slots.push_back(slot);
+      });
+    } else
+      process_incoming([](message *) -> message * { return nullptr; });
   }
 
-  void process_incoming_client() {
+  /* fast(msg) may answer a single pkt request right here by returning the
+   * response; the slot is not touched then. fast only runs while the
+   * response can be sent at once, so requests it declines with nullptr and
+   * those arriving on a full window take the slot path, served once. */
+  template <typename G>
+    requires(!P::is_client)
+  void process_incoming(G &&fast) {
     transport_impl->receive_messages([&](message *msg) {
       auto *hdr = rte_pktmbuf_mtod(msg, protocol::ft_header *);
       FASTT_LOG_DEBUG("Got new data for slot %u\n", hdr->msg_id);
-      slots[hdr->msg_id].handle_incoming_client(msg, hdr->fini);
+      auto &slot = slots[hdr->msg_id];
+      bool fini = hdr->fini;
       msg->shrink_headroom(sizeof(protocol::ft_header));
       FASTT_LOG_DEBUG("Got message of size %u\n", msg->pkt_len);
+      if (fini && slot.completed() && transport_impl->can_send())
+        if (auto *resp = fast(msg)) {
+          transport_impl->send_pkt(resp, slot.tid, true);
+          rte_pktmbuf_free(msg);
+          return;
+        }
+      slot.update_execution_state(inprogress);
+      slot.handle_incoming(msg, fini);
+      if (!slot.dispatched && !slot.ready_link.is_linked())
+        ready_slots.push_back(slot);
     });
   }
 
-  transaction_slot *start_transaction() {
-    if (free_slots.empty())
+  /* Calls cb for up to limit slots with incoming messages, in the order
+   * they became ready. Slots that still have messages afterwards queue up
+   * again behind the others. */
+  template <typename F> uint32_t run_ready(uint32_t limit, F &&cb) {
+    intrusive_list_t<transaction_slot, &transaction_slot::ready_link> batch;
+    batch.splice(batch.end(), ready_slots);
+    uint32_t ran = 0;
+    while (!batch.empty() && ran < limit) {
+      auto &slot = batch.front();
+      batch.pop_front();
+      cb(slot);
+      ++ran;
+      if (!slot.completed() && !slot.dispatched &&
+          slot.rx_if.has_incoming_messages())
+        ready_slots.push_back(slot);
+    }
+    ready_slots.splice(ready_slots.begin(), batch);
+    return ran;
+  }
+
+  /* Stale slots, see give_up, are only handed to callers that filter
+   * stale responses, i.e. completion_queue. */
+  transaction_slot *start_transaction(bool take_stale = false) {
+    if (free_slots.empty() ||
+        (!take_stale && slots[free_slots.front()].stale))
       return nullptr;
     auto slot_id = free_slots.front();
     free_slots.pop_front();
@@ -88,34 +180,286 @@ public:
 
   void finish_transaction(transaction_slot *slot) {
     slot->acknowledge();
-    free_slots.push_front(slot->tid);
+    slot->deadline_timer.stop();
+    slot->ready_link.unlink();
+    slot->hedge_link.unlink();
+    release(slot);
+  }
+
+  /* pkts of several slots in one burst, see basic_transport::send_burst */
+  uint16_t send_burst(const tx_entry *entries, uint16_t n) {
+    return transport_impl->send_burst(entries, n);
+  }
+
+  /* returns a slot whose request could not be sent */
+  void abort_transaction(transaction_slot *slot)
+    requires(P::is_client)
+  {
+    slot->has_outstanding_msgs = false;
+    slot->finish();
+    slot->ready_link.unlink();
+    release(slot);
+  }
+
+  /* Gives up on a running slot. Its request keeps its seqs, the peer
+   * needs every one, so the tid is reused once the response came back or,
+   * if that takes longer than kCancelTimeoutMs, once the request is acked;
+   * the slot is stale then, see give_up. */
+  void cancel_transaction(transaction_slot *slot)
+    requires(P::is_client)
+  {
+    slot->deadline_timer.stop();
+    slot->expired = false;
+    if (slot->completed()) {
+      recycle(slot);
+      return;
+    }
+    slot->cancelled = true;
+    slot->ready_link.unlink();
+    slot->hedge_link.unlink();
+    while (auto *msg = slot->rx_if.read())
+      rte_pktmbuf_free(msg);
+    slot->set_cancel_timeout(kCancelTimeoutMs);
+  }
+
+  /* cancel timeout of slot: frees it if the peer has its whole request,
+   * a response that still comes is dropped as stale */
+  void give_up(transaction_slot *slot)
+    requires(P::is_client)
+  {
+    if (!slot->cancelled)
+      return;
+    if (transport_impl->unacked(slot->tid)) {
+      slot->set_cancel_timeout(kCancelTimeoutMs);
+      return;
+    }
+    while (auto *msg = slot->rx_if.read())
+      rte_pktmbuf_free(msg);
+    slot->cancelled = false;
+    slot->stale = true;
+    slot->has_outstanding_msgs = false;
+    slot->finish();
+    finish_transaction(slot);
+  }
+
+  /* Sends msg as a single pkt transaction of the server, one of the tids
+   * agreed on in the handshake in turn. False if the client offered none
+   * or the window is full; msg is not consumed then. */
+  bool push(message *msg)
+    requires(!P::is_client)
+  {
+    auto tids = transport_impl->get_push_tids();
+    if (!tids)
+      return false;
+    if (!transport_impl->send_pkt(msg, transport::kPushTidBase + next_push,
+                                  true))
+      return false;
+    next_push = (next_push + 1) % tids;
+    arm_push_timer();
+    return true;
+  }
+
+  /* co_await con->call(req) sends req on a free slot and resumes with the
+   * response, see client_scheduler */
+  call_awaiter<basic_connection> call(message *req)
+    requires(P::is_client)
+  {
+    return {this, req};
   }
 
   connection_manager *get_manager() { return manager; }
 
+  /* no slot is being served on a worker lcore */
+  bool migratable() const {
+    for (auto &slot : inprogress)
+      if (slot.dispatched)
+        return false;
+    return true;
+  }
+
+  /* stops the slot timers on the lcore giving the connection away */
+  void detach() {
+    for (auto &slot : inprogress)
+      slot.stop_timer();
+    push_timer.stop();
+    push_armed = false;
+  }
+
+  /* Writes the connection for a hot restart: addressing, transport and the
+   * running slots with the messages they have not read yet. */
+  void save(restart::writer &w) {
+    w.put(flow);
+    w.put(transport_impl->target.ip);
+    w.put(transport_impl->target.port);
+    w.put(transport_impl->sport);
+    transport_impl->save(w);
+    uint16_t running = 0;
+    for ([[maybe_unused]] auto &slot : inprogress)
+      ++running;
+    w.put(running);
+    for (auto &slot : inprogress) {
+      w.put(slot.tid);
+      w.put(slot.has_outstanding_msgs);
+      w.put(static_cast<uint32_t>(slot.incoming.size()));
+      for (auto *msg : slot.incoming)
+        w.put_msg(msg, 0);
+    }
+  }
+
+  /* counterpart of save after the addressing was read, see
+   * basic_connection_manager::restore */
+  bool restore(restart::reader &r) {
+    if (!transport_impl->restore(r))
+      return false;
+    uint16_t running;
+    if (!r.get(running))
+      return false;
+    for (uint16_t i = 0; i < running; ++i) {
+      uint16_t tid;
+      bool outstanding;
+      uint32_t incoming;
+      if (!r.get(tid) || !r.get(outstanding) || !r.get(incoming) ||
+          tid >= slots.size())
+        return false;
+      auto &slot = slots[tid];
+      slot.update_execution_state(inprogress);
+      slot.has_outstanding_msgs = outstanding;
+      for (uint32_t k = 0; k < incoming; ++k) {
+        auto *msg = r.get_msg(allocator);
+        if (!msg)
+          return false;
+        slot.incoming.push_back(msg);
+      }
+      if (!slot.incoming.empty() && !slot.ready_link.is_linked())
+        ready_slots.push_back(slot);
+    }
+    if constexpr (!P::is_client)
+      arm_push_timer();
+    return true;
+  }
+
+  /* rearms the slot timers on the lcore taking the connection over */
+  void attach(connection_manager *new_manager, packet_if *pkt_if,
+              message_allocator *new_allocator) {
+    manager = new_manager;
+    allocator = new_allocator;
+    transport_impl->rebind(pkt_if, new_allocator);
+    for (auto &slot : inprogress)
+      slot.rearm();
+    if constexpr (!P::is_client)
+      arm_push_timer();
+  }
+
 private:
-  friend class connection_manager;
+  friend class basic_connection_manager<P>;
+
+  /* Pushes have no slot whose timer would resend them; a lost push that
+   * is the last pkt on the connection leaves no hole for a SACK either.
+   * The push timer probes the push tids like a slot timer probes its tid,
+   * until none of them has unacked pkts left. */
+  static void push_timer_cb(rte_timer *timer, void *arg) {
+    (void)timer;
+    auto *con = static_cast<basic_connection *>(arg);
+    con->push_armed = false;
+    bool pending = false;
+    for (uint16_t i = 0; i < con->transport_impl->get_push_tids(); ++i) {
+      auto tid = transport::kPushTidBase + i;
+      if (!con->transport_impl->unacked(tid))
+        continue;
+      con->transport_impl->probe_timeout(tid);
+      pending = true;
+    }
+    if (pending)
+      con->arm_push_timer();
+  }
+
+  void arm_push_timer() {
+    if (std::exchange(push_armed, true))
+      return;
+    push_timer.reset(get_ticks_ms() * P::kSlotTimeoutMs, push_timer_cb,
+                     rte_lcore_id(), this);
+  }
+
+  void release(transaction_slot *slot) {
+    slot->in_use = false;
+    /* a stale slot is taken last, its late response may still come */
+    if (slot->stale)
+      free_slots.push_back(slot->tid);
+    else
+      free_slots.push_front(slot->tid);
+  }
+
+  void recycle(transaction_slot *slot) {
+    while (auto *msg = slot->rx_if.read())
+      rte_pktmbuf_free(msg);
+    slot->cancelled = false;
+    finish_transaction(slot);
+  }
+
   message_allocator *allocator;
   std::unique_ptr<transport> transport_impl;
-  std::vector<transaction_slot> slots;
+  std::vector<transaction_slot, numa::allocator<transaction_slot>> slots;
   intrusive_list_t<transaction_slot, &transaction_slot::link> inprogress;
+  intrusive_list_t<transaction_slot, &transaction_slot::ready_link> ready_slots;
   std::deque<uint16_t> free_slots;
   connection_manager *manager;
+  /* tid of the next push is kPushTidBase + next_push */
+  uint16_t next_push = 0;
+  timer<dpdk_timer> push_timer;
+  bool push_armed = false;
 
 public:
   list_hook link;
+  /* queued on the ready list of the manager */
+  list_hook ready_link;
+  /* pkts arrived that the window may deliver */
+  bool rx_pending = false;
+  flow_tuple flow;
+  /* pkts received in the current rebalancing period */
+  uint64_t period_pkts = 0;
 };
 
-class connection_manager {
+template <typename P> class basic_connection_manager {
+  using connection = basic_connection<P>;
+  using transaction_slot = basic_transaction_slot<P>;
   static constexpr uint16_t kdefaultBurstSize = 32;
-  static constexpr uint16_t kdefaultFlowTableSize = 512;
+  /* room for many connections per lcore, e.g. a client talking to
+   * thousands of servers */
+  static constexpr uint32_t kdefaultFlowTableSize = 16384;
+  static constexpr uint32_t kdefaultForwardTableSize = 512;
+  /* pending INITs accepted per poll */
+  static constexpr uint32_t kdefaultAcceptBurst = 64;
 public:
-  connection_manager(bool is_client, uint16_t port, uint16_t txq, uint16_t rxq,
-                     uint32_t sip, std::shared_ptr<message_allocator> allocator,
-                     uint16_t lcore_id)
-      : flows(kdefaultFlowTableSize), allocator(allocator), dev(port, txq, rxq),
-        scheduler(&dev), pkt_if(&scheduler, sip, port), active(),
-        is_client(is_client), flush_timeout(get_ticks_us()),
+  /* entry of an inbox: either a connection moving to the owner of the inbox
+   * or a pkt of a connection that moved there before */
+  struct handoff {
+    connection *con;
+    message *pkt;
+    flow_tuple ft;
+  };
+
+  /* work done by one poll: budget slots over all connections and at most
+   * per_connection of them for the same connection */
+  struct poll_limits {
+    uint32_t budget = 256;
+    uint32_t per_connection = 32;
+  };
+
+  basic_connection_manager(uint16_t port, uint16_t txq, uint16_t rxq,
+                           uint32_t sip,
+                           std::shared_ptr<message_allocator> allocator,
+                           uint16_t lcore_id)
+      : basic_connection_manager(std::make_unique<dpdk_backend>(port, txq, rxq),
+                                 sip, allocator, lcore_id) {}
+
+  basic_connection_manager(std::unique_ptr<dev_backend> backend, uint32_t sip,
+                           std::shared_ptr<message_allocator> allocator,
+                           uint16_t lcore_id)
+      : flows(kdefaultFlowTableSize), allocator(allocator),
+        dev(std::move(backend)), scheduler(&dev),
+        pkt_if(&scheduler, sip, dev.macaddr()), active(),
+        forwards(kdefaultForwardTableSize),
+        socket(rte_lcore_to_socket_id(lcore_id)), flush_timeout(get_ticks_us()),
         flush_timer(timertype::PERIODICAL) {
     flush_timer.reset(flush_timeout, flush_cb, lcore_id, this);
   }
@@ -123,13 +467,22 @@ public:
   void handle_pkt(message *pkt, flow_tuple &ft) {
     FASTT_LOG_DEBUG("Got new pkt from: %d, %d\n", ft.sip,
                     rte_be_to_cpu_16(ft.sport));
+    if (nforwarded && forward(pkt, ft))
+      return;
     auto *header = rte_pktmbuf_mtod(pkt, protocol::ft_header *);
     if (header->type == protocol::FT_INIT)
       register_request(pkt, ft);
     else {
       auto *connection = flows.lookup(ft);
-      if (connection)
-        (*connection)->process_pkt(pkt);
+      if (connection && *connection) {
+        auto *con = connection->get();
+        ++con->period_pkts;
+        if (header->type == protocol::FT_MSG) {
+          con->rx_pending = true;
+          make_ready(*con);
+        }
+        con->process_pkt(pkt);
+      }
       else {
         dump_pkt(pkt, pkt->len());
         rte_pktmbuf_free(pkt);
@@ -142,47 +495,78 @@ public:
   }
 
   connection *open_connection(const con_config &source,
-                              const con_config &target) {
+                              const con_config &target, bool flush = true) {
     flow_tuple ft(target.ip, source.ip, rte_cpu_to_be_16(target.port),
                   rte_cpu_to_be_16(source.port));
     FASTT_LOG_DEBUG("Opened new connection to %d %d\n", ft.sip,
                     rte_be_to_cpu_16(ft.sport));
     auto [it, inserted] = flows.emplace(
-        ft, std::make_unique<connection>(allocator.get(), &pkt_if, target,
-                                         source.port, this, is_client));
+        ft, std::unique_ptr<connection>(new (socket) connection(
+                allocator.get(), &pkt_if, target, source.port, this)));
     if (!inserted)
       return nullptr;
+    it->get()->flow = ft;
     it->get()->open_connection();
     active.push_front(*it->get());
     ++open_connections;
-    flush();
+    if (flush)
+      this->flush();
     return it->get();
   }
 
-  template <typename F> void poll(F &&cb) {
-    fetch_from_device();
-    accept_connection();
-    for (auto &con : active) {
-      con.process_incoming_server();
-      auto &inprogress_list = con.inprogress;
-      auto it = inprogress_list.begin();
-      auto end = inprogress_list.end();
-      for (; it != end;) {
-        auto ts = it++;
-        cb(*ts);
+  template <typename F> uint32_t poll(F &&cb) {
+    return poll(cb, [](message *) -> message * { return nullptr; });
+  }
+
+  /* Only connections that received data and slots with incoming messages
+   * are visited, see poll_limits. On a server single pkt requests are first
+   * offered to fast, see basic_connection::process_incoming; on a client cb
+   * gets the slots whose response is complete. Returns the number of pkts
+   * received. */
+  template <typename F, typename G> uint32_t poll(F &&cb, G &&fast) {
+    uint32_t rcvd = fetch_from_device();
+    rcvd += drain_inbox();
+    accept_connections();
+    intrusive_list_t<connection, &connection::ready_link> batch;
+    batch.splice(batch.end(), ready);
+    auto budget = limits.budget;
+    while (!batch.empty() && budget) {
+      auto &con = batch.front();
+      batch.pop_front();
+      if (con.rx_pending) {
+        con.rx_pending = false;
+        if constexpr (P::is_client)
+          con.process_incoming();
+        else
+          con.process_incoming(fast);
       }
+      budget -= con.run_ready(std::min(budget, limits.per_connection), cb);
+      if (!con.ready_slots.empty())
+        ready.push_back(con);
     }
+    /* out of budget, the rest goes first next time */
+    ready.splice(ready.begin(), batch);
     con_timer_manager.manage();
+    return rcvd;
+  }
+
+  void set_poll_limits(const poll_limits &new_limits) { limits = new_limits; }
+
+  /* queues a slot that got messages while it was not polled */
+  void make_ready(transaction_slot &slot) {
+    if (!slot.ready_link.is_linked())
+      slot.owner->ready_slots.push_back(slot);
+    make_ready(*slot.owner);
   }
 
   void poll_single_connection(connection *con) {
     fetch_from_device();
-    con->process_incoming_client();
+    con->process_incoming();
     con_timer_manager.manage();
   }
 
-  void fetch_from_device() {
-    dev.rx_burst([this](message *pkt) {
+  uint16_t fetch_from_device() {
+    return dev.rx_burst([this](message *pkt) {
       flow_tuple ft;
       auto *msg = pkt_if.consume_pkt(pkt, ft);
       if (!msg)
@@ -202,25 +586,163 @@ public:
     auto [pkt, ft] = connection_requests.front();
     connection_requests.pop_front();
     auto [con, inserted] = add_connection(ft, rte_be_to_cpu_16(ft.dport));
+    if (!con) {
+      FASTT_LOG_DEBUG("Flow table full, dropping INIT\n");
+      rte_pktmbuf_free(pkt);
+      return nullptr;
+    }
     con->process_pkt(pkt);
     if (inserted) {
       con->accept();
       FASTT_LOG_DEBUG("Added new connection from %u %d\n", ft.sip, ft.sport);
-    }
+    } else
+      /* the peer retried, our INIT_ACK may have been lost */
+      con->retry_handshake();
     return con;
   }
+
+  uint32_t accept_connections() {
+    uint32_t accepted = 0;
+    while (accepted < kdefaultAcceptBurst && accept_connection())
+      ++accepted;
+    return accepted;
+  }
   std::pair<connection *, bool> add_connection(const flow_tuple &tuple,
                                                uint16_t port) {
-    auto [it, inserted] = flows.emplace(
-        tuple, std::make_unique<connection>(
-                   allocator.get(), &pkt_if,
-                   con_config{tuple.sip, rte_be_to_cpu_16(tuple.sport)}, port,
-                   this, is_client));
-    if (inserted) {
-      active.push_front(*it->get());
+    /* a retried INIT finds its connection, nothing is constructed */
+    auto *entry = flows.lookup(tuple);
+    if (entry && *entry)
+      return {entry->get(), false};
+    /* a new flow, or one whose entry a migration left empty */
+    if (!entry && !(entry = flows.emplace(tuple).first))
+      return {nullptr, false};
+    entry->reset(new (socket) connection(
+        allocator.get(), &pkt_if,
+        con_config{tuple.sip, rte_be_to_cpu_16(tuple.sport)}, port, this));
+    auto *con = entry->get();
+    con->flow = tuple;
+    con->transport_impl->limit_grant(grant_limit);
+    active.push_front(*con);
+    ++open_connections;
+    return {con, true};
+  }
+
+  void make_ready(connection &con) {
+    if (!con.ready_link.is_linked())
+      ready.push_back(con);
+  }
+
+  /* Connections move between lcores through the inbox of the target
+   * manager, a multi producer ring of handoff entries. Pkts of a moved
+   * connection still arrive here as long as the NIC steers the flow to this
+   * queue, they are passed on through the same ring, so they never overtake
+   * the connection itself. */
+  void set_inbox(rte_ring *ring) { inbox = ring; }
+
+  rte_ring *get_inbox() const { return inbox; }
+
+  /* Hands con to the manager owning the inbox to. Fails if a slot is still
+   * served by a worker or the inbox is full. */
+  bool migrate(connection *con, rte_ring *to) {
+    if (to == inbox || !con->migratable())
+      return false;
+    auto *fwd = forwards.emplace(con->flow).first;
+    auto *entry = flows.lookup(con->flow);
+    if (!fwd || !entry)
+      return false;
+    flush();
+    con->detach();
+    con->link.unlink();
+    con->ready_link.unlink();
+    entry->release();
+    handoff h{con, nullptr, con->flow};
+    if (rte_ring_mp_enqueue_elem(to, &h, sizeof(h))) {
+      entry->reset(con);
+      con->attach(this, &pkt_if, allocator.get());
+      active.push_front(*con);
+      con->rx_pending = true;
+      make_ready(*con);
+      return false;
+    }
+    if (!*fwd)
+      ++nforwarded;
+    *fwd = to;
+    --open_connections;
+    FASTT_LOG_DEBUG("Migrated connection of %u %u\n", h.ft.sip,
+                    rte_be_to_cpu_16(h.ft.sport));
+    return true;
+  }
+
+  /* Writes every connection for a hot restart, connections with a slot on a
+   * worker lcore are left out. Returns the number written. */
+  uint32_t save(restart::writer &w) {
+    uint32_t n = 0;
+    for (auto &con : active)
+      n += con.migratable();
+    w.put(n);
+    for (auto &con : active)
+      if (con.migratable())
+        con.save(w);
+    return n;
+  }
+
+  /* Rebuilds the connections a previous process saved, stops at the first
+   * one that cannot be restored. Returns the number restored. */
+  uint32_t restore(restart::reader &r) {
+    uint32_t n;
+    if (!r.get(n))
+      return 0;
+    uint32_t restored = 0;
+    for (; restored < n; ++restored) {
+      flow_tuple ft;
+      uint32_t ip;
+      uint16_t port, sport;
+      if (!r.get(ft) || !r.get(ip) || !r.get(port) || !r.get(sport))
+        break;
+      /* the flow table has no erase, a connection only goes in once it
+       * was restored */
+      std::unique_ptr<connection> restored_con(new (socket) connection(
+          allocator.get(), &pkt_if, con_config{ip, port}, sport, this));
+      restored_con->flow = ft;
+      if (!restored_con->restore(r)) {
+        restored_con->detach();
+        break;
+      }
+      auto [it, inserted] = flows.emplace(ft, std::move(restored_con));
+      if (!inserted) {
+        restored_con->detach();
+        break;
+      }
+      auto *con = it->get();
+      con->transport_impl->limit_grant(grant_limit);
+      active.push_front(*con);
       ++open_connections;
+      con->rx_pending = true;
+      make_ready(*con);
+    }
+    flush();
+    return restored;
+  }
+
+  void reset_period() {
+    for (auto &con : active)
+      con.period_pkts = 0;
+  }
+
+  /* Busiest connection with at most max_pkts in the current period that can
+   * be migrated, nullptr if there is none. Starts a new period. */
+  connection *rebalance_candidate(uint64_t max_pkts) {
+    connection *best = nullptr;
+    uint64_t best_pkts = 0;
+    for (auto &con : active) {
+      if (con.period_pkts > best_pkts && con.period_pkts <= max_pkts &&
+          con.migratable()) {
+        best = &con;
+        best_pkts = con.period_pkts;
+      }
+      con.period_pkts = 0;
     }
-    return {it->get(), inserted};
+    return best;
   }
 
   std::vector<statistics> get_stats() {
@@ -233,15 +755,76 @@ public:
 
   void flush() { scheduler.flush(); }
 
-  ~connection_manager() {
+  uint32_t connection_count() const { return open_connections; }
+
+  /* socket of the polling lcore */
+  int get_socket() const { return socket; }
+
+  /* window granted to every connection, see overload_control */
+  void limit_grants(uint16_t limit) {
+    grant_limit = limit;
+    for (auto &con : active)
+      con.transport_impl->limit_grant(limit);
+  }
+
+  ~basic_connection_manager() {
     flush_timer.stop();
     ;
   }
 
 private:
+  bool forward(message *pkt, const flow_tuple &ft) {
+    auto *to = forwards.lookup(ft);
+    if (!to || !*to)
+      return false;
+    handoff h{nullptr, pkt, ft};
+    /* a full inbox is a drop like on the wire */
+    if (rte_ring_mp_enqueue_elem(*to, &h, sizeof(h)))
+      rte_pktmbuf_free(pkt);
+    return true;
+  }
+
+  void adopt(connection *con) {
+    auto *entry = flows.emplace(con->flow).first;
+    if (!entry) {
+      FASTT_LOG_DEBUG("Flow table full, dropping migrated connection\n");
+      delete con;
+      return;
+    }
+    assert(!*entry);
+    entry->reset(con);
+    if (auto *fwd = forwards.lookup(con->flow); fwd && *fwd) {
+      *fwd = nullptr;
+      --nforwarded;
+    }
+    con->attach(this, &pkt_if, allocator.get());
+    con->transport_impl->limit_grant(grant_limit);
+    active.push_front(*con);
+    ++open_connections;
+    /* the window may hold data that arrived before the move */
+    con->rx_pending = true;
+    make_ready(*con);
+  }
+
+  uint32_t drain_inbox() {
+    if (!inbox)
+      return 0;
+    std::array<handoff, kdefaultBurstSize> entries;
+    auto n = rte_ring_sc_dequeue_burst_elem(inbox, entries.data(),
+                                            sizeof(handoff), entries.size(),
+                                            nullptr);
+    for (uint32_t i = 0; i < n; ++i) {
+      if (entries[i].con)
+        adopt(entries[i].con);
+      else
+        handle_pkt(entries[i].pkt, entries[i].ft);
+    }
+    return n;
+  }
+
   static void flush_cb(rte_timer *timer, void *arg) {
     (void)timer;
-    auto *this_ptr = static_cast<connection_manager *>(arg);
+    auto *this_ptr = static_cast<basic_connection_manager *>(arg);
     this_ptr->flush();
   }
   std::deque<std::pair<message *, flow_tuple>> connection_requests;
@@ -251,9 +834,22 @@ private:
   packet_scheduler scheduler;
   packet_if pkt_if;
   intrusive_list_t<connection> active;
-  bool is_client;
+  /* connections with rx_pending or ready slots */
+  intrusive_list_t<connection, &connection::ready_link> ready;
+  poll_limits limits;
+  /* flows that moved to another lcore, value is the inbox of their owner */
+  fixed_size_hash_table<flow_tuple, rte_ring *> forwards;
+  uint32_t nforwarded = 0;
+  rte_ring *inbox = nullptr;
+  uint16_t grant_limit = basic_transport<P>::kMaxGrant;
+  int socket;
   uint32_t open_connections = 0;
   uint64_t flush_timeout;
   timer<dpdk_timer> flush_timer;
   timer_manager<dpdk_timer> con_timer_manager;
 };
+
+using client_connection = basic_connection<client_policy>;
+using server_connection = basic_connection<server_policy>;
+using client_connection_manager = basic_connection_manager<client_policy>;
+using server_connection_manager = basic_connection_manager<server_policy>;
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "client.h"
+#include "connection.h"
+#include "util.h"
+#include <cstddef>
+#include <cstdint>
+#include <rte_cycles.h>
+#include <rte_ether.h>
+#include <span>
+#include <vector>
+
+/* Sets up many client connections at once. connect sends every FT_INIT in
+ * one pass, poll completes the connections as their INIT_ACKs arrive and
+ * resends the INITs that got no answer within retry_us, up to max_retries
+ * times. */
+class bulk_connector {
+public:
+  struct config {
+    uint64_t retry_us = 1000;
+    uint32_t max_retries = 10;
+  };
+
+  explicit bulk_connector(client_iface &cif) : bulk_connector(cif, config{}) {}
+  bulk_connector(client_iface &cif, const config &conf)
+      : cif(cif), conf(conf) {}
+
+  /* opens a connection to every target, all reached through dmac; returns
+   * how many could be opened */
+  std::size_t connect(std::span<const con_config> targets,
+                      rte_ether_addr dmac) {
+    auto now = rte_get_timer_cycles();
+    std::size_t opened = 0;
+    for (auto &target : targets) {
+      auto *con = cif.open_connection(target, dmac, false);
+      if (!con) {
+        ++failures;
+        continue;
+      }
+      pending.push_back({con, now, 0});
+      ++opened;
+    }
+    cif.flush();
+    return opened;
+  }
+
+  /* true once no connection is pending any more */
+  bool poll() {
+    auto &manager = cif.get_manager();
+    manager.fetch_from_device();
+    auto now = rte_get_timer_cycles();
+    auto timeout = conf.retry_us * get_ticks_us();
+    for (std::size_t i = 0; i < pending.size();) {
+      auto &p = pending[i];
+      if (p.con->active()) {
+        p.con->acknowledge_all();
+        established.push_back(p.con);
+      } else if (now - p.sent < timeout) {
+        ++i;
+        continue;
+      } else if (p.retries < conf.max_retries) {
+        p.con->retry_handshake();
+        p.sent = now;
+        ++p.retries;
+        ++retries;
+        ++i;
+        continue;
+      } else
+        ++failures;
+      p = pending.back();
+      pending.pop_back();
+    }
+    manager.flush();
+    return pending.empty();
+  }
+
+  const std::vector<client_connection *> &connections() const {
+    return established;
+  }
+
+  std::size_t failed() const { return failures; }
+  uint64_t resent() const { return retries; }
+
+private:
+  struct pending_connection {
+    client_connection *con;
+    /* timer cycles of the last INIT */
+    uint64_t sent;
+    uint32_t retries;
+  };
+
+  client_iface &cif;
+  config conf;
+  std::vector<pending_connection> pending;
+  std::vector<client_connection *> established;
+  std::size_t failures = 0;
+  uint64_t retries = 0;
+};
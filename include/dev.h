@@ -9,34 +9,74 @@
 #include <rte_ethdev.h>
 
 #include <array>
+#include <memory>
+
+/* Moves fully framed (Ethernet/IPv4/UDP) packets, sent mbufs are owned by
+ * the backend, received ones by the caller. */
+class dev_backend {
+public:
+  virtual uint16_t tx_burst(rte_mbuf **pkts, uint16_t cnt) = 0;
+  virtual uint16_t rx_burst(rte_mbuf **pkts, uint16_t cnt) = 0;
+  virtual void macaddr(rte_ether_addr *addr) = 0;
+  virtual ~dev_backend() = default;
+};
+
+class dpdk_backend final : public dev_backend {
+public:
+  dpdk_backend(uint16_t port, uint16_t txq, uint16_t rxq)
+      : port(port), txq(txq), rxq(rxq) {}
+
+  uint16_t tx_burst(rte_mbuf **pkts, uint16_t cnt) override {
+    return rte_eth_tx_burst(port, txq, pkts, cnt);
+  }
+
+  uint16_t rx_burst(rte_mbuf **pkts, uint16_t cnt) override {
+    return rte_eth_rx_burst(port, rxq, pkts, cnt);
+  }
+
+  void macaddr(rte_ether_addr *addr) override {
+    rte_eth_macaddr_get(port, addr);
+  }
+
+private:
+  uint16_t port;
+  uint16_t txq;
+  uint16_t rxq;
+};
 
 class netdev {
   static constexpr uint16_t kDefaultInputBurstSize = 32;
 public:
   netdev(uint16_t port, uint16_t txq, uint16_t rxq)
-      : port(port), txq(txq), rxq(rxq) {};
+      : backend(std::make_unique<dpdk_backend>(port, txq, rxq)) {};
+
+  netdev(std::unique_ptr<dev_backend> backend) : backend(std::move(backend)) {}
 
   uint16_t tx_burst(rte_mbuf **pkts, uint16_t cnt) {
     auto now = rte_get_timer_cycles() / get_ticks_us();   
-    auto sent = rte_eth_tx_burst(port, txq, pkts, cnt);
-    for(uint16_t i = 0; i < sent; ++i)
+    /* stamp before handing over, backends may free sent pkts right away */
+    for(uint16_t i = 0; i < cnt; ++i)
         *static_cast<message*>(pkts[i])->get_ts() = now;
-    return sent;
+    return backend->tx_burst(pkts, cnt);
   }
 
-  template <typename F> void rx_burst(F &&cb) {
+  template <typename F> uint16_t rx_burst(F &&cb) {
     std::array<rte_mbuf *, kDefaultInputBurstSize> pkts;
     auto now = rte_get_timer_cycles() / get_ticks_us();
-    auto rcvd =
-        rte_eth_rx_burst(port, rxq, pkts.data(), kDefaultInputBurstSize);
+    auto rcvd = backend->rx_burst(pkts.data(), kDefaultInputBurstSize);
     for (uint16_t i = 0; i < rcvd; ++i) {
       *static_cast<message*>(pkts[i])->get_ts() = now;  
       cb(static_cast<message*>(pkts[i]));
     }
+    return rcvd;
+  }
+
+  rte_ether_addr macaddr() {
+    rte_ether_addr addr;
+    backend->macaddr(&addr);
+    return addr;
   }
 
 private:
-  uint16_t port;
-  uint16_t txq;
-  uint16_t rxq;
+  std::unique_ptr<dev_backend> backend;
 };
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "debug.h"
+#include "message.h"
+#include "transport/slot.h"
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <rte_common.h>
+#include <rte_ring.h>
+#include <string>
+
+struct dispatch_entry {
+  server_slot *slot;
+  message *msg;
+};
+
+/* Pair of single producer single consumer rings between an I/O lcore and one
+ * worker lcore. The I/O lcore submits a slot together with its request, the
+ * worker answers with the response for that slot. The worker never touches
+ * the slot, sending and acknowledging stays on the I/O lcore. */
+class dispatch_channel {
+  static constexpr uint32_t kDepth = 1024;
+  static constexpr uint32_t kBurstSize = 32;
+
+public:
+  static std::unique_ptr<dispatch_channel> create(uint16_t id, int socket) {
+    auto name = std::to_string(id);
+    auto *requests =
+        rte_ring_create_elem(("dreq" + name).c_str(), sizeof(dispatch_entry),
+                             kDepth, socket, RING_F_SP_ENQ | RING_F_SC_DEQ);
+    auto *completions =
+        rte_ring_create_elem(("dcpl" + name).c_str(), sizeof(dispatch_entry),
+                             kDepth, socket, RING_F_SP_ENQ | RING_F_SC_DEQ);
+    if (!requests || !completions) {
+      FASTT_LOG_DEBUG("Creating dispatch rings failed\n");
+      rte_ring_free(requests);
+      rte_ring_free(completions);
+      return nullptr;
+    }
+    return std::unique_ptr<dispatch_channel>(
+        new dispatch_channel(requests, completions));
+  }
+
+  ~dispatch_channel() {
+    rte_ring_free(requests);
+    rte_ring_free(completions);
+  }
+
+  /* I/O lcore: hands msg of slot to the worker; fails if the worker is
+   * kDepth - 1 requests behind, which also keeps the completion ring from
+   * overflowing */
+  bool submit(server_slot *slot, message *msg) {
+    if (inflight == kDepth - 1)
+      return false;
+    dispatch_entry entry{slot, msg};
+    if (rte_ring_sp_enqueue_elem(requests, &entry, sizeof(entry)))
+      return false;
+    ++inflight;
+    return true;
+  }
+
+  /* I/O lcore: calls f(slot, response) for finished requests */
+  template <typename F> uint32_t complete(F &&f) {
+    dispatch_entry entries[kBurstSize];
+    auto n = rte_ring_sc_dequeue_burst_elem(completions, entries,
+                                            sizeof(dispatch_entry), kBurstSize,
+                                            nullptr);
+    for (uint32_t i = 0; i < n; ++i)
+      f(*entries[i].slot, entries[i].msg);
+    inflight -= n;
+    return n;
+  }
+
+  uint32_t outstanding() const { return inflight; }
+
+  /* I/O lcore: no more requests will be submitted */
+  void close() { closed.store(true, std::memory_order_release); }
+
+  /* worker lcore: answers pending requests with f(request) */
+  template <typename F> uint32_t serve(F &&f) {
+    dispatch_entry entries[kBurstSize];
+    auto n = rte_ring_sc_dequeue_burst_elem(
+        requests, entries, sizeof(dispatch_entry), kBurstSize, nullptr);
+    for (uint32_t i = 0; i < n; ++i)
+      entries[i].msg = f(entries[i].msg);
+    [[maybe_unused]] auto done = rte_ring_sp_enqueue_burst_elem(
+        completions, entries, sizeof(dispatch_entry), n, nullptr);
+    assert(done == n);
+    return n;
+  }
+
+  /* worker lcore: true once the I/O lcore closed the channel and every
+   * request has been taken */
+  bool drained() const {
+    return closed.load(std::memory_order_acquire) && rte_ring_empty(requests);
+  }
+
+private:
+  dispatch_channel(rte_ring *requests, rte_ring *completions)
+      : requests(requests), completions(completions) {}
+
+  rte_ring *requests;
+  rte_ring *completions;
+  /* only touched by the I/O lcore */
+  uint32_t inflight = 0;
+  alignas(RTE_CACHE_LINE_MIN_SIZE) std::atomic<bool> closed{false};
+};
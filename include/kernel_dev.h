@@ -0,0 +1,123 @@
+#pragma once
+
+#include "dev.h"
+#include "queue.h"
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <netinet/in.h>
+#include <rte_ether.h>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifdef FASTT_HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/* Runs the stack over a kernel UDP socket bound to ip:port, e.g. on loopback
+ * or on hosts without a NIC bound to DPDK. The rest of the stack still sees
+ * framed packets: on tx the destination is taken from the IPv4/UDP header
+ * and only the payload behind it is sent, on rx the headers are rebuilt from
+ * the source address of the datagram. */
+class udp_socket_backend : public dev_backend {
+protected:
+  static constexpr uint16_t kBurstSize = 32;
+  /* header mbuf + payload attached from an application buffer */
+  static constexpr uint16_t kMaxSegs = 4;
+
+public:
+  static std::unique_ptr<dev_backend> create(uint32_t ip, uint16_t port,
+                                             rte_mempool *pool);
+
+  void macaddr(rte_ether_addr *addr) override { *addr = kMac; }
+
+  ~udp_socket_backend() override;
+
+protected:
+  static constexpr rte_ether_addr kMac{{0x02, 0, 0, 0, 0, 0x01}};
+
+  udp_socket_backend(int fd, uint32_t ip, uint16_t port, rte_mempool *pool)
+      : fd(fd), ip(ip), port(port), pool(pool) {}
+
+  /* point iov at the payload segments of a framed pkt and fill in its
+   * destination, returns the number of iovecs used */
+  static uint16_t prepare_tx(rte_mbuf *pkt, iovec *iov, sockaddr_in &addr);
+  /* rebuild the headers of a datagram received behind them */
+  void finish_rx(rte_mbuf *pkt, uint32_t len, const sockaddr_in &addr);
+  bool prepare_rx(rte_mbuf *pkt, iovec &iov);
+
+  int fd;
+  uint32_t ip;
+  uint16_t port;
+  rte_mempool *pool;
+};
+
+/* recvmmsg/sendmmsg, one syscall per burst in each direction */
+class mmsg_backend final : public udp_socket_backend {
+public:
+  mmsg_backend(int fd, uint32_t ip, uint16_t port, rte_mempool *pool);
+
+  uint16_t tx_burst(rte_mbuf **pkts, uint16_t cnt) override;
+  uint16_t rx_burst(rte_mbuf **pkts, uint16_t cnt) override;
+
+  ~mmsg_backend() override;
+
+private:
+  bool refill();
+
+  uint16_t rx_missing = kBurstSize;
+  std::array<mmsghdr, kBurstSize> tx_msgs{};
+  std::array<std::array<iovec, kMaxSegs>, kBurstSize> tx_iovs{};
+  std::array<sockaddr_in, kBurstSize> tx_addrs{};
+  std::array<mmsghdr, kBurstSize> rx_msgs{};
+  std::array<iovec, kBurstSize> rx_iovs{};
+  std::array<sockaddr_in, kBurstSize> rx_addrs{};
+  std::array<rte_mbuf *, kBurstSize> rx_pkts{};
+};
+
+#ifdef FASTT_HAVE_LIBURING
+/* Keeps a recvmsg posted for every rx buffer and submits all sendmsgs of a
+ * burst with a single io_uring_enter. Sent mbufs are released once their
+ * completion is reaped. */
+class uring_backend final : public udp_socket_backend {
+  static constexpr uint16_t kTxSlots = 4 * kBurstSize;
+  static constexpr uint16_t kRingEntries = kTxSlots + kBurstSize;
+  static constexpr uint64_t kTxTag = 1;
+
+public:
+  static std::unique_ptr<dev_backend> create(int fd, uint32_t ip,
+                                             uint16_t port, rte_mempool *pool);
+
+  uint16_t tx_burst(rte_mbuf **pkts, uint16_t cnt) override;
+  uint16_t rx_burst(rte_mbuf **pkts, uint16_t cnt) override;
+
+  ~uring_backend() override;
+
+private:
+  struct io_slot {
+    msghdr hdr;
+    iovec iov[kMaxSegs];
+    sockaddr_in addr;
+    rte_mbuf *pkt;
+  };
+
+  uring_backend(int fd, uint32_t ip, uint16_t port, rte_mempool *pool)
+      : udp_socket_backend(fd, ip, port, pool), rx_ready(2 * kBurstSize) {}
+
+  bool post_recv(uint16_t idx);
+  void reap();
+
+  io_uring ring;
+  std::array<io_slot, kBurstSize> rx_slots{};
+  std::array<io_slot, kTxSlots> tx_slots{};
+  /* rx slots with a received datagram not yet handed out */
+  queue_base<uint16_t> rx_ready;
+  /* rx slots without a posted recvmsg since allocating a buffer failed */
+  std::array<uint16_t, kBurstSize> rx_idle{};
+  uint16_t rx_nidle = 0;
+  std::array<uint16_t, kTxSlots> tx_free_list{};
+  uint16_t tx_free = 0;
+};
+#endif
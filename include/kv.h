@@ -4,6 +4,8 @@
 #include "message.h"
 #include <cstdint>
 
+class lease_cache;
+
 static constexpr uint16_t payload_offset = 0;
 enum class packet_t: uint8_t{
     SINGLE = 0, BATCH = 1,
@@ -11,10 +13,12 @@ enum class packet_t: uint8_t{
 
 enum class request_t: uint8_t{
     GET = 0, PUT = 1, DELETE = 2,
+    /* the server pushes the changes of key, see watch_table */
+    WATCH = 3,
 };
 
 enum class response_t: uint8_t{
-    SUCCESS, FAILURE,
+    SUCCESS, FAILURE, BUSY,
 };
 
 struct[[gnu::packed]] kv_packet_base{
@@ -31,6 +35,15 @@ struct [[gnu::packed]] kv_request {
 struct [[gnu::packed]] kv_completion {
     response_t reponse;
     int64_t val;
+    /* read lease on the key granted with a GET, 0 for none, see lease_table */
+    uint32_t lease_us;
+};
+
+/* change of a watched key, pushed in a kv_batch */
+struct [[gnu::packed]] kv_notification {
+    request_t op;
+    int64_t key;
+    int64_t val;
 };
 
 template<typename T>
@@ -46,6 +59,7 @@ struct [[gnu::packed]] kv_batch : public kv_packet_base{
 
 inline void create_put_request(message* msg, int64_t key, int64_t val){
     auto* kv_req = static_cast<kv_packet<kv_request>*>(msg->data());
+    kv_req->pt = packet_t::SINGLE;
     kv_req->payload.op = request_t::PUT;
     kv_req->payload.key = key;
     kv_req->payload.val = val;
@@ -58,21 +72,73 @@ inline void create_get_request(message* msg, int64_t key){
     kv_req->payload.key = key;
 }
 
+inline void create_delete_request(message* msg, int64_t key){
+    auto* kv_req = static_cast<kv_packet<kv_request>*>(msg->data());
+    kv_req->pt = packet_t::SINGLE;
+    kv_req->payload.op = request_t::DELETE;
+    kv_req->payload.key = key;
+}
+
+inline void create_watch_request(message* msg, int64_t key){
+    auto* kv_req = static_cast<kv_packet<kv_request>*>(msg->data());
+    kv_req->pt = packet_t::SINGLE;
+    kv_req->payload.op = request_t::WATCH;
+    kv_req->payload.key = key;
+}
+
+/* completion_queue::stale_filter of KV requests: the generation goes into
+ * kv_packet_base::id, which servers echo */
+inline void kv_stamp_generation(message* req, uint64_t generation){
+    static_cast<kv_packet_base*>(req->data())->id = generation;
+}
+
+inline bool kv_has_generation(message* resp, uint64_t generation){
+    return static_cast<kv_packet_base*>(resp->data())->id == generation;
+}
+
+/* the KV wire format as an rpc protocol, see rpc::dispatcher */
+struct kv_rpc {
+    using request = kv_packet<kv_request>;
+    using response = kv_packet<kv_completion>;
+    using opcode = request_t;
+
+    static opcode op(const request& req){ return req.payload.op; }
+
+    /* answers req with status and val, without a lease */
+    static void reply(const request& req, response& resp, response_t status, int64_t val = 0){
+        resp.pt = req.pt;
+        resp.id = req.id;
+        resp.payload.reponse = status;
+        resp.payload.val = val;
+        resp.payload.lease_us = 0;
+    }
+
+    static void unknown(const request& req, response& resp){
+        reply(req, resp, response_t::FAILURE);
+    }
+};
+
 struct transaction_proxy;
 
 class kv_proxy{
     public:
-        kv_proxy(client_iface* ifc, connection* con): ifc(ifc), con(con){}
+        kv_proxy(client_iface* ifc, client_connection* con, lease_cache* cache = nullptr)
+            : ifc(ifc), con(con), cache(cache){}
  
-        std::unique_ptr<transaction_proxy> start_transaction(connection* con, transaction_queue& q);
+        std::unique_ptr<transaction_proxy> start_transaction(client_connection* con, transaction_queue& q);
         void lookup(int64_t key, message* msg){
             create_get_request(msg, key);
         };
+        /* true if the cache holds a lease on key, no request is needed then */
+        bool lookup_cached(int64_t key, int64_t& val);
+        /* hands the response of a GET sent at timer cycles sent to the cache */
+        void complete_lookup(int64_t key, message* resp, uint64_t sent);
         void acknowledge() { con->acknowledge_all(); }
         void finish_transaction(transaction_proxy* proxy);
         void flush(){ ifc->flush(); }
     private:
             client_iface* ifc;
-            connection* con;
+            client_connection* con;
+            lease_cache* cache;
 
 };
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "kv.h"
+#include "message.h"
+#include "transport/slot.h"
+#include "util.h"
+#include <algorithm>
+#include <cstdint>
+#include <rte_cycles.h>
+#include <unordered_map>
+#include <vector>
+
+/* Read leases of one server lcore. A GET may grant the client a lease of
+ * lease_us on the key, see kv_completion::lease_us; until every lease on a
+ * key ran out its PUTs are deferred, so a client may answer reads of the key
+ * from its lease_cache. While a write waits no new leases are granted on
+ * the key, readers cannot starve it. */
+class lease_table {
+public:
+  explicit lease_table(uint32_t lease_us) : lease_us(lease_us) {}
+
+  /* lease for a GET of key, 0 if none */
+  uint32_t grant(int64_t key) {
+    if (!lease_us)
+      return 0;
+    auto &lease = leases[key];
+    if (lease.waiting)
+      return 0;
+    lease.expires = std::max(lease.expires, rte_get_timer_cycles() +
+                                                lease_us * get_ticks_us());
+    return lease_us;
+  }
+
+  /* a PUT of key has to be deferred: some lease on it has not run out or
+   * an earlier PUT still waits */
+  bool blocked(int64_t key) {
+    auto it = leases.find(key);
+    if (it == leases.end())
+      return false;
+    if (it->second.waiting || rte_get_timer_cycles() < it->second.expires)
+      return true;
+    leases.erase(it);
+    return false;
+  }
+
+  /* keeps the PUT req of slot for release, the slot stays running */
+  void defer(int64_t key, server_slot *slot, message *req) {
+    ++leases[key].waiting;
+    deferred.push_back({key, slot, req});
+  }
+
+  /* apply(slot, req) for the deferred PUTs whose leases ran out, in the
+   * order they arrived; returns how many ran */
+  template <typename F> uint32_t release(F &&apply) {
+    if (deferred.empty())
+      return 0;
+    auto now = rte_get_timer_cycles();
+    uint32_t released = 0;
+    std::erase_if(deferred, [&](const deferred_put &put) {
+      auto &lease = leases[put.key];
+      if (now < lease.expires)
+        return false;
+      --lease.waiting;
+      apply(put.slot, put.req);
+      ++released;
+      return true;
+    });
+    return released;
+  }
+
+  std::size_t waiting() const { return deferred.size(); }
+
+private:
+  struct lease {
+    /* timer cycles the last lease granted runs out */
+    uint64_t expires = 0;
+    /* deferred PUTs of the key */
+    uint32_t waiting = 0;
+  };
+
+  struct deferred_put {
+    int64_t key;
+    server_slot *slot;
+    message *req;
+  };
+
+  uint32_t lease_us;
+  std::unordered_map<int64_t, lease> leases;
+  std::vector<deferred_put> deferred;
+};
+
+/* Client side of the leases: values of leased keys until their lease runs
+ * out. A lease counts from when the GET was sent, before the server granted
+ * it, so it ends on the client first as long as the clocks of both run at
+ * about the same rate. */
+class lease_cache {
+public:
+  struct statistics {
+    uint64_t hits = 0, misses = 0;
+  };
+
+  /* true and the value if key holds a lease */
+  bool lookup(int64_t key, int64_t &val) {
+    auto it = entries.find(key);
+    if (it == entries.end() || rte_get_timer_cycles() >= it->second.expires) {
+      ++stats.misses;
+      return false;
+    }
+    val = it->second.val;
+    ++stats.hits;
+    return true;
+  }
+
+  /* takes the lease of a GET response; sent is the timer cycles the GET
+   * was submitted at */
+  void fill(int64_t key, const kv_completion &resp, uint64_t sent) {
+    if (resp.reponse != response_t::SUCCESS || !resp.lease_us)
+      return;
+    entries[key] = {resp.val, sent + resp.lease_us * get_ticks_us()};
+  }
+
+  /* drops key, e.g. on our own PUT */
+  void invalidate(int64_t key) { entries.erase(key); }
+
+  const statistics &get_stats() const { return stats; }
+
+private:
+  struct entry {
+    int64_t val;
+    uint64_t expires;
+  };
+
+  std::unordered_map<int64_t, entry> entries;
+  statistics stats;
+};
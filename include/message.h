@@ -4,6 +4,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <rte_ether.h>
+#include <string>
 #include <rte_mbuf.h>
 #include <rte_mbuf_core.h>
 #include <rte_memory.h>
@@ -31,18 +32,37 @@ struct message : public rte_mbuf {
 
 static_assert(sizeof(message) == sizeof(rte_mbuf), "");
 
+/* called with the application buffer once no mbuf references it anymore */
+using external_completion_cb = void (*)(void *buf, void *arg);
+
 class message_allocator {
   static constexpr uint16_t kRequiredHeadRoom = 128;
   static constexpr std::size_t kMempoolCacheSize = 256;
   static constexpr std::size_t kMemBufPrivSize = 0;
   static constexpr std::size_t kMemBufDataRoomSize = RTE_MBUF_DEFAULT_BUF_SIZE;
 
+  /* lives in the private area of the mbuf attached to the buffer, which is
+   * still valid when the free callback runs */
+  struct external_ctx {
+    rte_mbuf_ext_shared_info shinfo;
+    external_completion_cb cb;
+    void *arg;
+  };
+  static constexpr std::size_t kExtPrivSize =
+      RTE_ALIGN(sizeof(external_ctx), RTE_MBUF_PRIV_ALIGN);
+
 public:
-  message_allocator(const char *name, std::size_t elems)
+  /* socket should be the one of the lcore allocating and freeing */
+  message_allocator(const char *name, std::size_t elems,
+                    int socket = SOCKET_ID_ANY)
       : pool(rte_pktmbuf_pool_create(name, elems, kMempoolCacheSize,
                                      kMemBufPrivSize, kMemBufDataRoomSize,
-                                     SOCKET_ID_ANY)) {
+                                     socket)),
+        ext_pool(rte_pktmbuf_pool_create((std::string(name) + "_ext").c_str(),
+                                         elems, kMempoolCacheSize,
+                                         kExtPrivSize, 0, socket)) {
     assert(pool && "allocation failed");        
+    assert(ext_pool && "allocation failed");
     payload_size = RTE_MBUF_DEFAULT_DATAROOM;
     assert(payload_size > 0);
     FASTT_LOG_DEBUG("Payload Size: %lu\n", payload_size);
@@ -57,11 +77,52 @@ public:
     return prepare(mbuf, data_size);
   }
 
+  /* Header mbuf with room for the protocol headers followed by an mbuf
+   * attached to buf, so the payload is sent without copying it. buf has to be
+   * DMA-able (DPDK memory or registered with rte_extmem_register) and must
+   * not change until cb ran. Retransmissions share the chain, so cb runs after
+   * the final ack and the last transmission released it. */
+  message *alloc_external(void *buf, uint16_t len, external_completion_cb cb,
+                          void *arg) {
+    auto iova = rte_mem_virt2iova(buf);
+    if (iova == RTE_BAD_IOVA)
+      return nullptr;
+    auto *ext = rte_pktmbuf_alloc(ext_pool);
+    if (!ext)
+      return nullptr;
+    auto *msg = alloc_message(0);
+    if (!msg) {
+      rte_pktmbuf_free(ext);
+      return nullptr;
+    }
+    auto *ctx = static_cast<external_ctx *>(rte_mbuf_to_priv(ext));
+    ctx->cb = cb;
+    ctx->arg = arg;
+    ctx->shinfo.free_cb = external_free;
+    ctx->shinfo.fcb_opaque = ctx;
+    rte_mbuf_ext_refcnt_set(&ctx->shinfo, 1);
+    rte_pktmbuf_attach_extbuf(ext, buf, iova, len, &ctx->shinfo);
+    ext->data_len = len;
+    ext->pkt_len = len;
+    rte_pktmbuf_chain(msg, ext);
+    return msg;
+  }
+
   static void deallocate(message *msg) { rte_pktmbuf_free(msg); }
 
-  ~message_allocator() { rte_mempool_free(pool); }
+  rte_mempool *mempool() { return pool; }
+
+  ~message_allocator() {
+    rte_mempool_free(ext_pool);
+    rte_mempool_free(pool);
+  }
 
 private:
+  static void external_free(void *addr, void *opaque) {
+    auto *ctx = static_cast<external_ctx *>(opaque);
+    ctx->cb(addr, ctx->arg);
+  }
+
   message *prepare(rte_mbuf *mbuf, uint16_t data_size) {
     if constexpr(RTE_PKTMBUF_HEADROOM < kRequiredHeadRoom)  
         rte_pktmbuf_adj(mbuf, kRequiredHeadRoom - RTE_PKTMBUF_HEADROOM);
@@ -72,4 +133,5 @@ private:
   }
   std::size_t payload_size;
   rte_mempool *pool;
+  rte_mempool *ext_pool;
 };
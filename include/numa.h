@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <rte_common.h>
+#include <rte_lcore.h>
+#include <rte_malloc.h>
+#include <rte_memory.h>
+
+/* State touched per pkt lives on the socket of the lcore polling it. These
+ * helpers place allocations in the DPDK heap of a socket and fall back to
+ * any socket once that heap is exhausted. */
+namespace numa {
+
+__inline int local_socket() { return static_cast<int>(rte_socket_id()); }
+
+__inline void *alloc(std::size_t size, int socket) {
+  auto *ptr = rte_malloc_socket(nullptr, size, RTE_CACHE_LINE_SIZE, socket);
+  if (!ptr)
+    ptr = rte_malloc_socket(nullptr, size, RTE_CACHE_LINE_SIZE, SOCKET_ID_ANY);
+  if (!ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+/* std allocator on a fixed socket, for containers of per connection state */
+template <typename T> struct allocator {
+  using value_type = T;
+
+  explicit allocator(int socket = local_socket()) : socket(socket) {}
+  template <typename U>
+  allocator(const allocator<U> &other) : socket(other.socket) {}
+
+  T *allocate(std::size_t n) {
+    return static_cast<T *>(alloc(n * sizeof(T), socket));
+  }
+  void deallocate(T *ptr, std::size_t) { rte_free(ptr); }
+
+  template <typename U> bool operator==(const allocator<U> &other) const {
+    return socket == other.socket;
+  }
+
+  int socket;
+};
+
+/* Base of objects that are created with new (socket) T(...). There is no
+ * plain operator new, so the socket cannot be forgotten. */
+struct placed {
+  static void *operator new(std::size_t size, int socket) {
+    return alloc(size, socket);
+  }
+  static void operator delete(void *ptr) { rte_free(ptr); }
+  static void operator delete(void *ptr, int) { rte_free(ptr); }
+};
+
+} // namespace numa
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "transport/transport.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <utility>
+
+/* Breakwater style credit pool of one server lcore. The pool grows
+ * additively while the p99 queueing delay of a period stays below the SLO
+ * and shrinks multiplicatively with the overshoot otherwise. Credits reach
+ * the clients as the wnd grant of the transport, split evenly over the
+ * connections. While the pool shrinks, clients still hold credits granted
+ * before, so requests that already waited longer than the SLO are rejected
+ * instead of served. */
+class overload_control {
+  static constexpr uint32_t kBuckets = 64;
+  /* the histogram covers kBuckets / kBucketsPerSlo times the SLO */
+  static constexpr uint32_t kBucketsPerSlo = 16;
+  static constexpr double kBeta = 0.5;
+  static constexpr double kMaxDecrease = 0.5;
+
+public:
+  struct config {
+    /* p99 queueing delay target */
+    uint64_t slo_us = 200;
+    uint64_t period_us = 100;
+  };
+
+  explicit overload_control(const config &conf)
+      : conf(conf), bucket_us(std::max<uint64_t>(conf.slo_us / kBucketsPerSlo, 1)) {}
+
+  void record(uint64_t delay_us) {
+    ++histogram[std::min<uint64_t>(delay_us / bucket_us, kBuckets - 1)];
+    ++samples;
+  }
+
+  /* adjusts the pool once per period, true if the grant changed */
+  bool update(uint64_t now_us, uint32_t connections) {
+    if (now_us < period_start + conf.period_us)
+      return false;
+    period_start = now_us;
+    /* nothing to share, the next connections start with full windows
+     * instead of whatever an empty pool clamps to */
+    if (!connections) {
+      overloaded = false;
+      histogram.fill(0);
+      samples = 0;
+      return std::exchange(credits, std::numeric_limits<double>::max()) !=
+             std::numeric_limits<double>::max();
+    }
+    auto old = grant(connections);
+    auto lo = static_cast<double>(connections);
+    auto hi = lo * kMaxGrant;
+    auto p99 = percentile(0.99);
+    overloaded = p99 > conf.slo_us;
+    if (overloaded)
+      credits *= std::max(1 - kBeta * (p99 - conf.slo_us) / p99, kMaxDecrease);
+    else
+      credits += connections;
+    credits = std::clamp(credits, lo, hi);
+    histogram.fill(0);
+    samples = 0;
+    return grant(connections) != old;
+  }
+
+  /* per connection share of the pool, at least one pkt */
+  uint16_t grant(uint32_t connections) const {
+    if (!connections)
+      return kMaxGrant;
+    return std::clamp<uint32_t>(credits / connections, 1, kMaxGrant);
+  }
+
+  bool reject(uint64_t delay_us) const {
+    return overloaded && delay_us > conf.slo_us;
+  }
+
+  double get_credits() const { return credits; }
+
+private:
+  static constexpr uint32_t kMaxGrant = server_transport::kMaxGrant;
+
+  uint64_t percentile(double p) const {
+    if (!samples)
+      return 0;
+    uint64_t seen = 0;
+    auto target = static_cast<uint64_t>(samples * p);
+    for (uint32_t i = 0; i < kBuckets; ++i) {
+      seen += histogram[i];
+      if (seen > target)
+        return (i + 1) * bucket_us;
+    }
+    return kBuckets * bucket_us;
+  }
+
+  config conf;
+  uint64_t bucket_us;
+  std::array<uint64_t, kBuckets> histogram{};
+  uint64_t samples = 0;
+  uint64_t period_start = 0;
+  /* full windows until an update with connections clamps it */
+  double credits = std::numeric_limits<double>::max();
+  bool overloaded = false;
+};
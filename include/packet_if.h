@@ -3,8 +3,10 @@
 #include "debug.h"
 #include "message.h"
 #include "packet_scheduler.h"
+#include "protocol.h"
 #include "util.h"
 #include <cstdint>
+#include <cstring>
 #include <rte_byteorder.h>
 #include <rte_ether.h>
 #include <rte_ip.h>
@@ -13,15 +15,28 @@
 #include <rte_mbuf_core.h>
 #include <rte_udp.h>
 
+/* Ethernet, IPv4 and UDP header of a connection with everything except the
+ * lengths and the length dependent part of the pseudo header checksum filled
+ * in. Built once per connection, so the tx path only copies it in front of
+ * the ft header and patches the lengths. */
+struct alignas(RTE_CACHE_LINE_MIN_SIZE) header_template {
+  static constexpr uint16_t kSize = protocol::defs::kftOffset;
+  static_assert(kSize == 42, "");
+  uint8_t hdr[kSize];
+  /* one's complement sum of the pseudo header without the l4 length */
+  uint32_t phdr_sum;
+  bool valid = false;
+};
+
 class packet_if {
   static constexpr uint16_t kdefaultTTL = 64;
   static constexpr uint16_t kdefaultARPTableSize = 1024;
 
 public:
-  packet_if(packet_scheduler *scheduler, uint32_t sip, uint16_t port)
-      : arp_table(kdefaultARPTableSize), scheduler(scheduler), sip(sip) {
-    rte_eth_macaddr_get(port, &smac);
-  }
+  packet_if(packet_scheduler *scheduler, uint32_t sip,
+            const rte_ether_addr &smac)
+      : arp_table(kdefaultARPTableSize), smac(smac), scheduler(scheduler),
+        sip(sip) {}
 
   rte_udp_hdr *udp_header(message *msg, uint16_t sport, uint16_t dport) {
     auto *udp = msg->move_headroom<rte_udp_hdr>();
@@ -63,17 +78,95 @@ public:
     msg->l2_len = sizeof(rte_ether_hdr);
   }
 
-  void consume_pkt(message *msg, uint16_t sport,
-                   const con_config &tcon_config) {
+  void write_headers(message *msg, uint16_t sport,
+                     const con_config &tcon_config) {
     auto *udp = udp_header(msg, sport, tcon_config.port);
     ip_header(msg, udp, sip, tcon_config.ip);
     auto *addr = arp_table.lookup(tcon_config.ip);
     assert(addr);
     eth_header(msg, smac, *addr);
+  }
+
+  bool build_template(header_template &tmpl, uint16_t sport,
+                      const con_config &tcon_config) {
+    auto *addr = arp_table.lookup(tcon_config.ip);
+    if (!addr)
+      return false;
+    std::memset(tmpl.hdr, 0, sizeof(tmpl.hdr));
+    auto *eth = reinterpret_cast<rte_ether_hdr *>(tmpl.hdr);
+    rte_ether_addr_copy(addr, &eth->dst_addr);
+    rte_ether_addr_copy(&smac, &eth->src_addr);
+    eth->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+
+    auto *ipv4 =
+        reinterpret_cast<rte_ipv4_hdr *>(tmpl.hdr + protocol::defs::kipOffset);
+    ipv4->src_addr = sip;
+    ipv4->dst_addr = tcon_config.ip;
+    ipv4->next_proto_id = IPPROTO_UDP;
+    ipv4->time_to_live = kdefaultTTL;
+    ipv4->version_ihl = RTE_IPV4_VHL_DEF;
+
+    auto *udp =
+        reinterpret_cast<rte_udp_hdr *>(tmpl.hdr + protocol::defs::kudpOffset);
+    udp->src_port = rte_cpu_to_be_16(sport);
+    udp->dst_port = rte_cpu_to_be_16(tcon_config.port);
+
+    /* same word order as rte_ipv4_phdr_cksum, the length is added per pkt */
+    uint16_t addrs[4];
+    std::memcpy(addrs, &ipv4->src_addr, sizeof(addrs));
+    tmpl.phdr_sum = addrs[0] + addrs[1] + addrs[2] + addrs[3] +
+                    rte_cpu_to_be_16(IPPROTO_UDP);
+    tmpl.valid = true;
+    return true;
+  }
+
+  void write_headers(message *msg, const header_template &tmpl) {
+    assert(tmpl.valid);
+    uint16_t l4_len = msg->pkt_len + sizeof(rte_udp_hdr);
+    auto *hdr = reinterpret_cast<uint8_t *>(
+        rte_pktmbuf_prepend(msg, header_template::kSize));
+    /* constant size, compiles to a few vector moves */
+    std::memcpy(hdr, tmpl.hdr, header_template::kSize);
+    auto *ipv4 =
+        reinterpret_cast<rte_ipv4_hdr *>(hdr + protocol::defs::kipOffset);
+    auto *udp =
+        reinterpret_cast<rte_udp_hdr *>(hdr + protocol::defs::kudpOffset);
+    ipv4->total_length = rte_cpu_to_be_16(l4_len + sizeof(rte_ipv4_hdr));
+    udp->dgram_len = rte_cpu_to_be_16(l4_len);
+    uint32_t sum = tmpl.phdr_sum + rte_cpu_to_be_16(l4_len);
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    udp->dgram_cksum = static_cast<uint16_t>(sum);
+    msg->l2_len = sizeof(rte_ether_hdr);
+    msg->l3_len = sizeof(rte_ipv4_hdr);
+    msg->l4_len = sizeof(rte_udp_hdr);
+    msg->ol_flags =
+        RTE_MBUF_F_TX_IP_CKSUM | RTE_MBUF_F_TX_UDP_CKSUM | RTE_MBUF_F_TX_IPV4;
+  }
+
+  void consume_pkt(message *msg, uint16_t sport,
+                   const con_config &tcon_config) {
+    write_headers(msg, sport, tcon_config);
+    FASTT_DUMP_PKT(msg, msg->len());
+    scheduler->add_pkt(static_cast<rte_mbuf *>(msg));
+  }
+
+  void consume_pkt(message *msg, const header_template &tmpl) {
+    write_headers(msg, tmpl);
     FASTT_DUMP_PKT(msg, msg->len());
     scheduler->add_pkt(static_cast<rte_mbuf *>(msg));
   }
 
+  /* headers of a burst to the same peer, then one scheduler insertion */
+  void consume_burst(message *const *msgs, uint16_t n,
+                     const header_template &tmpl) {
+    for (uint16_t i = 0; i < n; ++i) {
+      write_headers(msgs[i], tmpl);
+      FASTT_DUMP_PKT(msgs[i], msgs[i]->len());
+    }
+    scheduler->add_burst(reinterpret_cast<rte_mbuf *const *>(msgs), n);
+  }
+
   void consume_for_retransmission(message *msg) { scheduler->add_pkt(msg); }
 
   void add_mapping(uint32_t ip, rte_ether_addr &addr) {
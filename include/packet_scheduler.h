@@ -9,6 +9,8 @@ class packet_scheduler {
 public:
   static constexpr uint16_t kDefaultOutBurstSize = 32;  
   bool add_pkt(rte_mbuf *pkt);
+  /* queues n pkts, sending whenever the buffer fills up */
+  void add_burst(rte_mbuf *const *pkts, uint16_t n);
   uint16_t flush();
   packet_scheduler(netdev *dev): dev(dev), buffer(kDefaultOutBurstSize), ptr(0) {}
 
@@ -35,8 +35,10 @@ struct __rte_packed_begin ft_sack_payload{
 
 void prepare_ft_header(message* msg, uint64_t seq, uint64_t ack, uint64_t msg_id, uint16_t wnd, bool fini = false, uint32_t us = 0);
 void prepare_ack_pkt(message* msg, uint64_t ack, uint16_t wnd, uint32_t us, bool is_sack = false);
-void prepare_init_header(message* msg, uint64_t seq);
-void prepare_init_ack_header(message* msg, uint64_t seq, uint64_t ack, uint16_t wnd);
+/* msg_id of FT_INIT and FT_INIT_ACK carries the number of server initiated
+ * tids offered by the client and accepted by the server */
+void prepare_init_header(message* msg, uint64_t seq, uint16_t push_tids = 0);
+void prepare_init_ack_header(message* msg, uint64_t seq, uint64_t ack, uint16_t wnd, uint16_t push_tids = 0);
 
 namespace defs{
   static constexpr uint16_t kipOffset = sizeof(rte_ether_hdr);
@@ -45,6 +45,11 @@ public:
       return (tail + capacity - head) & mask;
   }
 
+  /* entries that can still be enqueued */
+  std::size_t space() const{
+      return capacity - 1 - size();
+  }
+
 protected:
   std::vector<T> storage;
   std::size_t capacity;
@@ -0,0 +1,182 @@
+#pragma once
+
+#include "debug.h"
+#include "message.h"
+#include "transaction.h"
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_ring.h>
+#include <span>
+#include <string>
+#include <vector>
+
+/* request of a thread that does not poll, see submission_ring */
+struct remote_request {
+  client_connection *con;
+  message *req;
+  uint64_t tag;
+  /* rte_rdtsc when queued */
+  uint64_t queued;
+};
+
+struct remote_completion {
+  uint64_t tag;
+  /* nullptr if the request expired, see completion */
+  message *resp;
+  /* rte_rdtsc when posted */
+  uint64_t posted;
+};
+
+class submission_ring;
+
+/* Handle of one producer thread, which may be any thread, not only an
+ * lcore. Requests go through the shared ring, completions come back on the
+ * producer's own single producer single consumer ring. */
+class remote_producer {
+public:
+  static constexpr uint32_t kDepth = 1024;
+  /* the top bits of the tag passed to completion_queue name the producer */
+  static constexpr uint32_t kTagBits = 48;
+
+  ~remote_producer() { rte_ring_free(completions); }
+
+  /* false if the shared ring is full or kDepth - 1 requests are outstanding,
+   * which keeps the completion ring from overflowing; req is not consumed.
+   * tag must fit kTagBits. */
+  bool submit(client_connection *con, message *req, uint64_t tag) {
+    assert(tag >> kTagBits == 0);
+    if (inflight == kDepth - 1)
+      return false;
+    remote_request entry{con, req, static_cast<uint64_t>(id) << kTagBits | tag,
+                         rte_rdtsc()};
+    if (rte_ring_mp_enqueue_elem(requests, &entry, sizeof(entry)))
+      return false;
+    ++inflight;
+    return true;
+  }
+
+  std::size_t poll(std::span<remote_completion> out) {
+    auto n = rte_ring_sc_dequeue_burst_elem(completions, out.data(),
+                                            sizeof(remote_completion),
+                                            out.size(), nullptr);
+    inflight -= n;
+    return n;
+  }
+
+  uint32_t outstanding() const { return inflight; }
+
+private:
+  friend class submission_ring;
+  remote_producer(uint16_t id, rte_ring *requests, rte_ring *completions)
+      : id(id), requests(requests), completions(completions) {}
+
+  uint16_t id;
+  rte_ring *requests;
+  rte_ring *completions;
+  /* only touched by the producer thread */
+  uint32_t inflight = 0;
+};
+
+/* Lock-free multi producer single consumer submission ring of a client
+ * connection_manager. Producer threads queue requests for any connection
+ * of the manager, the lcore polling it moves them onto transaction slots
+ * through its completion_queue and posts each completion back to the ring
+ * of the producer that submitted it. The completion_queue belongs to the
+ * ring then; the lcore polls it only through poll. */
+class submission_ring {
+  static constexpr uint32_t kDepth = 4096;
+  static constexpr uint32_t kBurstSize = 32;
+
+public:
+  struct statistics {
+    uint64_t submitted = 0;
+    /* rte_rdtsc cycles requests waited in the ring, summed */
+    uint64_t queued_cycles = 0;
+  };
+
+  static std::unique_ptr<submission_ring>
+  create(uint16_t id, completion_queue &cq, uint16_t producers, int socket) {
+    auto name = std::to_string(id);
+    auto *requests =
+        rte_ring_create_elem(("sreq" + name).c_str(), sizeof(remote_request),
+                             kDepth, socket, RING_F_SC_DEQ);
+    if (!requests) {
+      FASTT_LOG_DEBUG("Creating submission ring failed\n");
+      return nullptr;
+    }
+    std::unique_ptr<submission_ring> ring(new submission_ring(requests, cq));
+    for (uint16_t i = 0; i < producers; ++i) {
+      auto *completions = rte_ring_create_elem(
+          ("scpl" + name + "-" + std::to_string(i)).c_str(),
+          sizeof(remote_completion), remote_producer::kDepth, socket,
+          RING_F_SP_ENQ | RING_F_SC_DEQ);
+      if (!completions) {
+        FASTT_LOG_DEBUG("Creating completion ring failed\n");
+        return nullptr;
+      }
+      ring->producers.emplace_back(new remote_producer(i, requests, completions));
+    }
+    return ring;
+  }
+
+  ~submission_ring() {
+    producers.clear();
+    rte_ring_free(requests);
+  }
+
+  /* handed to one thread each */
+  remote_producer *producer(uint16_t i) { return producers[i].get(); }
+
+  /* polling lcore: submits queued requests until a connection runs out of
+   * slots or window, polls the completion_queue and posts what completed */
+  uint32_t poll() {
+    if (pending == npending) {
+      pending = 0;
+      npending = rte_ring_sc_dequeue_burst_elem(
+          requests, batch, sizeof(remote_request), kBurstSize, nullptr);
+    }
+    auto now = rte_rdtsc();
+    for (; pending < npending; ++pending) {
+      auto &entry = batch[pending];
+      if (!cq.submit(entry.con, entry.req, entry.tag))
+        break;
+      ++stats.submitted;
+      stats.queued_cycles += now - entry.queued;
+    }
+    completion done[kBurstSize];
+    auto n = cq.poll_completions(done);
+    now = rte_rdtsc();
+    for (std::size_t i = 0; i < n; ++i) {
+      /* pushes belong to no producer */
+      if (done[i].tag == completion_queue::kPushTag) {
+        rte_pktmbuf_free(done[i].resp);
+        continue;
+      }
+      auto *to = producers[done[i].tag >> remote_producer::kTagBits].get();
+      remote_completion entry{
+          done[i].tag & ((1ull << remote_producer::kTagBits) - 1),
+          done[i].resp, now};
+      [[maybe_unused]] auto posted = rte_ring_sp_enqueue_elem(
+          to->completions, &entry, sizeof(entry));
+      assert(posted == 0);
+    }
+    return n;
+  }
+
+  const statistics &get_stats() const { return stats; }
+
+private:
+  submission_ring(rte_ring *requests, completion_queue &cq)
+      : requests(requests), cq(cq) {}
+
+  rte_ring *requests;
+  completion_queue &cq;
+  std::vector<std::unique_ptr<remote_producer>> producers;
+  /* dequeued requests not submitted yet, batch[pending, npending) */
+  remote_request batch[kBurstSize];
+  uint32_t pending = 0, npending = 0;
+  statistics stats;
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "message.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <optional>
+#include <string>
+#include <rte_mbuf.h>
+#include <type_traits>
+
+/* Hot restart: on hand over the old server process writes the connections
+ * of every I/O lcore into a file in shared hugepage memory and stops, the
+ * new process maps it, rebuilds its connections and resumes. Peers only
+ * notice the pkts sent while neither process polled, which the transport
+ * retransmits. Both processes need the same address, port and number of
+ * I/O lcores. */
+namespace restart {
+
+/* Sequential serializer; without a buffer it only counts, so the size of a
+ * region is known before it is created. */
+class writer {
+public:
+  writer() = default;
+  writer(void *buf, std::size_t cap)
+      : buf(static_cast<uint8_t *>(buf)), cap(cap) {}
+
+  template <typename T> void put(const T &val) {
+    static_assert(std::is_trivially_copyable_v<T>, "");
+    bytes(&val, sizeof(val));
+  }
+
+  void bytes(const void *data, std::size_t n) {
+    if (buf && len + n <= cap)
+      std::memcpy(buf + len, data, n);
+    len += n;
+  }
+
+  /* pkt_len - skip bytes of msg starting at offset skip of the first segment */
+  void put_msg(const rte_mbuf *msg, uint16_t skip) {
+    put(static_cast<uint16_t>(msg->pkt_len - skip));
+    for (auto *seg = msg; seg; seg = seg->next) {
+      bytes(rte_pktmbuf_mtod_offset(seg, uint8_t *, skip), seg->data_len - skip);
+      skip = 0;
+    }
+  }
+
+  std::size_t size() const { return len; }
+  bool ok() const { return !buf || len <= cap; }
+
+private:
+  uint8_t *buf = nullptr;
+  std::size_t cap = 0;
+  std::size_t len = 0;
+};
+
+class reader {
+public:
+  reader(const void *buf, std::size_t len)
+      : buf(static_cast<const uint8_t *>(buf)), len(len) {}
+
+  template <typename T> bool get(T &val) {
+    static_assert(std::is_trivially_copyable_v<T>, "");
+    return bytes(&val, sizeof(val));
+  }
+
+  bool bytes(void *data, std::size_t n) {
+    if (pos + n > len)
+      return false;
+    std::memcpy(data, buf + pos, n);
+    pos += n;
+    return true;
+  }
+
+  /* counterpart of writer::put_msg, nullptr if out of data or mbufs */
+  message *get_msg(message_allocator *allocator) {
+    uint16_t n;
+    if (!get(n) || pos + n > len)
+      return nullptr;
+    auto *msg = allocator->alloc_message(n);
+    if (!msg)
+      return nullptr;
+    std::memcpy(rte_pktmbuf_mtod(msg, void *), buf + pos, n);
+    *msg->get_ts() = 0;
+    pos += n;
+    return msg;
+  }
+
+private:
+  const uint8_t *buf;
+  std::size_t len;
+  std::size_t pos = 0;
+};
+
+struct region_header {
+  static constexpr uint32_t kMagic = 0x66747273;
+  /* set once the state is complete */
+  std::atomic<uint32_t> magic;
+  uint32_t connections;
+  /* CLOCK_MONOTONIC when the old process stopped polling */
+  uint64_t stopped_ns;
+  uint64_t len;
+};
+
+uint64_t monotonic_ns();
+
+/* Writes the state of I/O lcore idx of the server at ip:port with
+ * save(writer), which returns the number of connections written. */
+bool publish(uint32_t ip, uint16_t port, uint16_t idx, uint64_t stopped_ns,
+             const std::function<uint32_t(writer &)> &save);
+
+/* state published by the previous process for I/O lcore idx */
+class snapshot {
+public:
+  static std::optional<snapshot> open(uint32_t ip, uint16_t port,
+                                      uint16_t idx);
+
+  snapshot(snapshot &&other) noexcept;
+  snapshot(const snapshot &) = delete;
+  /* unmaps and removes the region, it is only taken over once */
+  ~snapshot();
+
+  reader data() const;
+  uint32_t connections() const { return hdr->connections; }
+  uint64_t stopped_ns() const { return hdr->stopped_ns; }
+
+private:
+  snapshot(region_header *hdr, std::size_t mapped, std::string path)
+      : hdr(hdr), mapped(mapped), path(std::move(path)) {}
+
+  region_header *hdr;
+  std::size_t mapped;
+  std::string path;
+};
+
+} // namespace restart
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "message.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <rte_mbuf.h>
+#include <type_traits>
+
+/* Typed requests over messages. A wire protocol P names its request and
+ * response structs and where the opcode is:
+ *
+ *   struct P {
+ *     using request = ...;
+ *     using response = ...;
+ *     using opcode = ...;  an enum or integer of at most 16 bits
+ *     static opcode op(const request &);
+ *     static void unknown(const request &, response &);
+ *   };
+ *
+ * A dispatcher serves the methods of P registered with it through a jump
+ * table built at compile time. Requests are read in place and responses
+ * written in place, see view. */
+namespace rpc {
+
+/* Zero copy view of a T at the start of the data of msg. T is a packed
+ * wire struct, bind its members by value, not by reference. */
+template <typename T> class view {
+  static_assert(std::is_trivially_copyable_v<std::remove_const_t<T>>);
+
+public:
+  explicit view(message *msg) : msg(msg) {}
+
+  T *operator->() const { return rte_pktmbuf_mtod(msg, T *); }
+  T &operator*() const { return *operator->(); }
+
+  /* msg holds a whole T */
+  bool fits() const { return rte_pktmbuf_data_len(msg) >= sizeof(T); }
+
+  message *get() const { return msg; }
+
+private:
+  message *msg;
+};
+
+/* Op served by Fn(ctx, request, response) */
+template <auto Op, auto Fn> struct method {
+  static constexpr auto op = Op;
+  static constexpr auto fn = Fn;
+};
+
+/* Serves the methods Ms of protocol P with a context of type Ctx, which
+ * may be const. Opcodes without a method get P::unknown. */
+template <typename P, typename Ctx, typename... Ms> class dispatcher {
+  using request = typename P::request;
+  using response = typename P::response;
+  using opcode = typename P::opcode;
+  using handler = void (*)(Ctx &, const request &, response &);
+
+  static constexpr std::size_t index(opcode op) {
+    if constexpr (std::is_enum_v<opcode>)
+      return static_cast<std::make_unsigned_t<std::underlying_type_t<opcode>>>(
+          op);
+    else
+      return static_cast<std::make_unsigned_t<opcode>>(op);
+  }
+
+  static_assert(sizeof(opcode) <= 2, "opcodes index a table");
+  static_assert((std::is_convertible_v<decltype(Ms::fn), handler> && ...),
+                "a method takes (Ctx &, const request &, response &)");
+
+  static constexpr bool unique() {
+    std::array<std::size_t, sizeof...(Ms)> ops{index(Ms::op)...};
+    for (std::size_t i = 0; i < ops.size(); ++i)
+      for (std::size_t j = i + 1; j < ops.size(); ++j)
+        if (ops[i] == ops[j])
+          return false;
+    return true;
+  }
+  static_assert(unique(), "an opcode is registered twice");
+
+  /* the table ends at the highest registered opcode */
+  static constexpr std::size_t kOps = std::max({std::size_t{0},
+                                                (index(Ms::op) + 1)...});
+
+  static void unknown(Ctx &, const request &req, response &resp) {
+    P::unknown(req, resp);
+  }
+
+  static constexpr std::array<handler, kOps> table = [] {
+    std::array<handler, kOps> t{};
+    t.fill(&unknown);
+    ((t[index(Ms::op)] = Ms::fn), ...);
+    return t;
+  }();
+
+  static constexpr handler lookup(opcode op) {
+    return index(op) < kOps ? table[index(op)] : &unknown;
+  }
+
+public:
+  static constexpr bool registered(opcode op) {
+    return lookup(op) != &unknown;
+  }
+
+  /* the response to msg, which is left to the caller; nullptr if msg is
+   * shorter than a request or no message could be allocated */
+  static message *serve(Ctx &ctx, message *msg, message_allocator *allocator) {
+    view<const request> req(msg);
+    if (!req.fits())
+      return nullptr;
+    auto *resp = allocator->alloc_message(sizeof(response));
+    if (!resp)
+      return nullptr;
+    view<response> out(resp);
+    lookup(P::op(*req))(ctx, *req, *out);
+    return resp;
+  }
+};
+
+} // namespace rpc
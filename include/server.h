@@ -17,15 +17,27 @@ public:
                const con_config &scon_config,
                std::shared_ptr<message_allocator> pool)
       : scon_config(scon_config),
-        manager(false, port, txq, rxq, scon_config.ip, pool, rte_lcore_id()) {}
+        manager(port, txq, rxq, scon_config.ip, pool, rte_lcore_id()) {}
+  server_iface(std::unique_ptr<dev_backend> backend,
+               const con_config &scon_config,
+               std::shared_ptr<message_allocator> pool)
+      : scon_config(scon_config), manager(std::move(backend),
+                                          scon_config.ip, pool,
+                                          rte_lcore_id()) {}
 
   void complete() { manager.flush(); };
 
   template<typename F>
-   void poll(F&& f){
-       manager.poll(f);
+   uint32_t poll(F&& f){
+       return manager.poll(f);
    }   
+
+  template <typename F, typename G> uint32_t poll(F &&f, G &&fast) {
+    return manager.poll(f, fast);
+  }
+
+  server_connection_manager &get_manager() { return manager; }
 private:
   con_config scon_config;
-  connection_manager manager;
+  server_connection_manager manager;
 };
@@ -0,0 +1,529 @@
+#pragma once
+
+#include "dev.h"
+#include "dispatch.h"
+#include "message.h"
+#include "overload.h"
+#include "restart.h"
+#include "server.h"
+#include "transport/slot.h"
+#include "util.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <rte_common.h>
+#include <rte_cycles.h>
+#include <rte_launch.h>
+#include <rte_lcore.h>
+#include <rte_pause.h>
+#include <rte_ring.h>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/* Runs one server_iface per I/O lcore, each on its own rx/tx queue. Flows are
+ * spread over the queues by the NIC (RSS/RETA set up in configure_port) or,
+ * for the kernel backend, by SO_REUSEPORT. Connections never move between
+ * lcores, so the lcores share nothing but the stop flag.
+ * With workers the last lcores only serve requests the I/O lcores dispatch
+ * to them, see run_dispatched. A worker belongs to an I/O lcore on its own
+ * socket, see assign_workers.
+ * With a migration_policy connections move from lcores that stay busier than
+ * the others, see rebalance. */
+class server_runtime {
+  static constexpr std::size_t kPoolSize = 8095;
+  static constexpr uint32_t kInboxSize = 1024;
+  using handoff = server_connection_manager::handoff;
+
+public:
+  /* backend for the queue with the given index, created on its lcore */
+  using backend_factory = std::function<std::unique_ptr<dev_backend>(
+      uint16_t queue, message_allocator *allocator)>;
+
+  struct alignas(RTE_CACHE_LINE_MIN_SIZE) lcore_stats {
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> dispatched{0};
+    std::atomic<uint64_t> migrated{0};
+    std::atomic<uint64_t> rejected{0};
+    /* permille of cycles spent on iterations that received pkts */
+    std::atomic<uint32_t> load{0};
+    /* connections taken over from the previous process and the time
+     * between its last poll and this lcore's first */
+    std::atomic<uint32_t> restored{0};
+    std::atomic<uint64_t> blackout_us{0};
+  };
+
+  struct migration_policy {
+    /* load difference to the least loaded lcore, in permille */
+    uint32_t imbalance = 200;
+    /* consecutive periods the difference has to last */
+    uint32_t periods = 5;
+    uint64_t period_ms = 100;
+  };
+
+  server_runtime(const con_config &scon_config, backend_factory factory,
+                 uint16_t workers = 0)
+      : scon_config(scon_config), factory(std::move(factory)),
+        workers(std::min<uint16_t>(workers, rte_lcore_count() - 1)),
+        stats(rte_lcore_count()) {
+    unsigned lcore;
+    RTE_LCORE_FOREACH(lcore)
+      sockets.push_back(rte_lcore_to_socket_id(lcore));
+  }
+
+  /* lcores running a server_iface, queues 0 .. io_lcores() - 1 are used */
+  uint16_t io_lcores() const { return rte_lcore_count() - workers; }
+
+  /* Calls handler(slot, allocator) for every slot with incoming data on all
+   * I/O lcores until stop() is called. The main lcore takes part, so this
+   * returns once every lcore has flushed and torn down its connections. */
+  template <typename F> int run(F &&handler) {
+    using handler_t = std::remove_reference_t<F>;
+    context<handler_t> ctx{this, &handler, 0};
+    return launch(lcore_main<handler_t>, ctx);
+  }
+
+  /* Serves single message requests with service.serve(msg, allocator), which
+   * returns the response. Requests for which service.dispatch(msg) is true
+   * are served on a worker lcore, so a slow request does not hold up rx,
+   * acks and timers of the I/O lcore; all others are served inline. serve
+   * runs concurrently on the workers and must only share read only state.
+   * With the fast path enabled, single pkt requests for which
+   * service.idempotent(msg) is true are served straight from the rx path
+   * without a slot; a retransmitted request gets the stored response. */
+  template <typename S> int run_dispatched(S &&service) {
+    using service_t = std::remove_reference_t<S>;
+    channels.clear();
+    worker_allocators.clear();
+    for (uint16_t w = 0; w < workers; ++w) {
+      auto socket = sockets[io_lcores() + w];
+      auto channel = dispatch_channel::create(w, socket);
+      if (!channel)
+        return -1;
+      channels.push_back(std::move(channel));
+      /* responses sit in the retransmission queues of the I/O lcores after
+       * the worker is gone, so the pools live as long as the runtime */
+      worker_allocators.push_back(make_allocator("wrk", w, socket));
+    }
+    assign_workers();
+    context<service_t> ctx{this, &service, 0};
+    return launch(dispatch_main<service_t>, ctx);
+  }
+
+  void enable_migration(const migration_policy &policy) { migration = policy; }
+
+  /* only applies to run_dispatched, busy responses come from
+   * service.reject(msg, allocator) or are empty */
+  void enable_overload_control(const overload_control::config &conf) {
+    overload_config = conf;
+  }
+
+  /* see run_dispatched, only for services with idempotent(msg) */
+  void enable_fast_path(bool enable) { fast_path = enable; }
+
+  void set_poll_limits(
+      const server_connection_manager::poll_limits &new_limits) {
+    limits = new_limits;
+  }
+
+  /* async-signal-safe */
+  void stop() { running.store(false, std::memory_order_release); }
+
+  /* Like stop, but every I/O lcore publishes its connections for the next
+   * process on the way out, see restart.h. async-signal-safe. */
+  void hand_over() {
+    handing_over.store(true, std::memory_order_relaxed);
+    stop();
+  }
+
+  /* the I/O lcores take over what the previous process handed over */
+  void take_over(bool enable) { restore = enable; }
+
+  const std::vector<lcore_stats> &get_stats() const { return stats; }
+
+  double seconds() const {
+    return static_cast<double>(end - start) / rte_get_timer_hz();
+  }
+
+private:
+  template <typename F> struct context {
+    server_runtime *runtime;
+    F *handler;
+    std::atomic<int> failed;
+  };
+
+  struct lcore_balance {
+    uint64_t period_start = rte_get_timer_cycles();
+    uint64_t busy = 0;
+    uint64_t pkts = 0;
+    uint32_t strikes = 0;
+  };
+
+  template <typename F> int launch(lcore_function_t *f, context<F> &ctx) {
+    allocators.assign(io_lcores(), nullptr);
+    if (migration && !create_inboxes())
+      return -1;
+    running.store(true, std::memory_order_release);
+    start = rte_get_timer_cycles();
+    rte_eal_mp_remote_launch(f, &ctx, CALL_MAIN);
+    rte_eal_mp_wait_lcore();
+    end = rte_get_timer_cycles();
+    free_inboxes();
+    return ctx.failed.load();
+  }
+
+  bool create_inboxes() {
+    for (uint16_t i = 0; i < io_lcores(); ++i) {
+      auto *ring = rte_ring_create_elem(("inbox" + std::to_string(i)).c_str(),
+                                        sizeof(handoff), kInboxSize,
+                                        sockets[i], RING_F_SC_DEQ);
+      if (!ring) {
+        free_inboxes();
+        return false;
+      }
+      inboxes.push_back(ring);
+    }
+    return true;
+  }
+
+  /* whatever was handed over after its new owner stopped */
+  void free_inboxes() {
+    for (auto *ring : inboxes) {
+      handoff h;
+      while (!rte_ring_sc_dequeue_elem(ring, &h, sizeof(h))) {
+        if (h.con)
+          delete h.con;
+        else
+          rte_pktmbuf_free(h.pkt);
+      }
+      rte_ring_free(ring);
+    }
+    inboxes.clear();
+  }
+
+  /* Every worker is served by an I/O lcore on its own socket, round robin
+   * over those; a worker on a socket without I/O lcores falls back to
+   * w % io_lcores(). */
+  void assign_workers() {
+    worker_owner.assign(workers, 0);
+    std::vector<uint16_t> next(io_lcores(), 0);
+    for (uint16_t w = 0; w < workers; ++w) {
+      auto socket = sockets[io_lcores() + w];
+      std::vector<uint16_t> local;
+      for (uint16_t i = 0; i < io_lcores(); ++i)
+        if (sockets[i] == socket)
+          local.push_back(i);
+      if (local.empty()) {
+        worker_owner[w] = w % io_lcores();
+        continue;
+      }
+      worker_owner[w] = local[next[local.front()]++ % local.size()];
+    }
+  }
+
+  /* I/O lcore pools outlive their lcore, a migrated connection may still
+   * hold mbufs from them */
+  std::shared_ptr<message_allocator>
+  make_allocator(const char *prefix, int idx, int socket) {
+    return std::make_shared<message_allocator>(
+        (prefix + std::to_string(idx)).c_str(), kPoolSize, socket);
+  }
+
+  std::unique_ptr<server_iface>
+  make_server(uint16_t idx, std::shared_ptr<message_allocator> allocator) {
+    allocators[idx] = allocator;
+    auto backend = factory(idx, allocator.get());
+    if (!backend) {
+      stop();
+      return nullptr;
+    }
+    auto server = std::make_unique<server_iface>(std::move(backend),
+                                                 scon_config, allocator);
+    if (!inboxes.empty())
+      server->get_manager().set_inbox(inboxes[idx]);
+    server->get_manager().set_poll_limits(limits);
+    return server;
+  }
+
+  /* before the first poll of I/O lcore idx */
+  void resume(uint16_t idx, server_connection_manager &manager) {
+    if (!restore)
+      return;
+    auto snap = restart::snapshot::open(scon_config.ip, scon_config.port, idx);
+    if (!snap)
+      return;
+    auto r = snap->data();
+    stats[idx].restored.store(manager.restore(r), std::memory_order_relaxed);
+    stats[idx].blackout_us.store(
+        (restart::monotonic_ns() - snap->stopped_ns()) / 1000,
+        std::memory_order_relaxed);
+  }
+
+  /* after the last poll of I/O lcore idx, which ended at stopped_ns */
+  void suspend(uint16_t idx, server_connection_manager &manager,
+               uint64_t stopped_ns) {
+    if (!handing_over.load(std::memory_order_acquire))
+      return;
+    if (!restart::publish(scon_config.ip, scon_config.port, idx, stopped_ns,
+                          [&](restart::writer &w) { return manager.save(w); }))
+      FASTT_LOG_DEBUG("Handing over lcore %u failed\n", idx);
+  }
+
+  /* Called after every poll iteration. Once per period the lcore publishes
+   * its load; if it stayed more than policy.imbalance above the least loaded
+   * lcore for policy.periods periods, its busiest connection carrying at
+   * most half the difference moves there. A connection's share of the load
+   * is taken to be its share of the received pkts. Connections only move
+   * within a socket, their state stays where it was allocated. */
+  void rebalance(uint16_t idx, lcore_balance &state,
+                 server_connection_manager &manager, uint64_t iteration_start,
+                 uint32_t rcvd) {
+    auto now = rte_get_timer_cycles();
+    if (rcvd) {
+      state.busy += now - iteration_start;
+      state.pkts += rcvd;
+    }
+    auto period = now - state.period_start;
+    if (period < migration->period_ms * rte_get_timer_hz() / 1000)
+      return;
+    uint32_t load = state.busy * 1000 / period;
+    auto pkts = state.pkts;
+    stats[idx].load.store(load, std::memory_order_relaxed);
+    state.period_start = now;
+    state.busy = state.pkts = 0;
+
+    uint16_t target = idx;
+    uint32_t least = load;
+    for (uint16_t i = 0; i < io_lcores(); ++i) {
+      if (sockets[i] != sockets[idx])
+        continue;
+      auto other = stats[i].load.load(std::memory_order_relaxed);
+      if (other < least) {
+        least = other;
+        target = i;
+      }
+    }
+    if (load - least <= migration->imbalance) {
+      state.strikes = 0;
+      manager.reset_period();
+      return;
+    }
+    if (++state.strikes < migration->periods) {
+      manager.reset_period();
+      return;
+    }
+    state.strikes = 0;
+    auto max_pkts = pkts * (load - least) / 2 / load;
+    auto *con = manager.rebalance_candidate(max_pkts);
+    if (con && manager.migrate(con, inboxes[target]))
+      stats[idx].migrated.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  template <typename F> static int lcore_main(void *arg) {
+    auto *ctx = static_cast<context<F> *>(arg);
+    auto *rt = ctx->runtime;
+    auto idx = rte_lcore_index(rte_lcore_id());
+    if (idx >= rt->io_lcores())
+      return 0;
+    auto allocator = rt->make_allocator("srv", idx, rt->sockets[idx]);
+    auto server = rt->make_server(idx, allocator);
+    if (!server) {
+      ctx->failed.store(-1);
+      return -1;
+    }
+    uint64_t requests = 0;
+    lcore_balance balance;
+    rt->resume(idx, server->get_manager());
+    while (rt->running.load(std::memory_order_acquire)) {
+      auto iteration_start = rte_get_timer_cycles();
+      auto rcvd = server->poll([&](server_slot &slot) {
+        (*ctx->handler)(slot, allocator.get());
+        ++requests;
+      });
+      server->complete();
+      if (rt->migration)
+        rt->rebalance(idx, balance, server->get_manager(), iteration_start,
+                      rcvd);
+      rt->stats[idx].requests.store(requests, std::memory_order_relaxed);
+    }
+    auto stopped = restart::monotonic_ns();
+    server->complete();
+    rt->suspend(idx, server->get_manager(), stopped);
+    return 0;
+  }
+
+  template <typename S> static int dispatch_main(void *arg) {
+    auto *ctx = static_cast<context<S> *>(arg);
+    auto idx = rte_lcore_index(rte_lcore_id());
+    if (idx >= ctx->runtime->io_lcores())
+      return worker_main(ctx, idx - ctx->runtime->io_lcores());
+    return io_main(ctx, idx);
+  }
+
+  static void respond(server_slot &slot, message *resp) {
+    if (resp)
+      slot.tx_if.send(resp, true);
+    if (!slot.has_outstanding_messages())
+      slot.finish();
+  }
+
+  template <typename S>
+  static message *busy_response(S &service, message *msg,
+                                message_allocator *allocator) {
+    if constexpr (requires { service.reject(msg, allocator); })
+      return service.reject(msg, allocator);
+    else
+      return allocator->alloc_message(0);
+  }
+
+  template <typename S> static int io_main(context<S> *ctx, uint16_t idx) {
+    auto *rt = ctx->runtime;
+    std::vector<dispatch_channel *> own;
+    for (uint16_t w = 0; w < rt->workers; ++w)
+      if (rt->worker_owner[w] == idx)
+        own.push_back(rt->channels[w].get());
+    auto allocator = rt->make_allocator("srv", idx, rt->sockets[idx]);
+    auto server = rt->make_server(idx, allocator);
+    if (!server) {
+      for (auto *channel : own)
+        channel->close();
+      ctx->failed.store(-1);
+      return -1;
+    }
+
+    uint64_t requests = 0, dispatched = 0, rejected = 0;
+    auto &manager = server->get_manager();
+    std::optional<overload_control> overload;
+    if (rt->overload_config)
+      overload.emplace(*rt->overload_config);
+    auto on_complete = [&](server_slot &slot, message *resp) {
+      slot.dispatched = false;
+      respond(slot, resp);
+      /* messages that came in while the worker had the slot */
+      if (slot.rx_if.has_incoming_messages())
+        manager.make_ready(slot);
+      ++requests;
+    };
+    /* busy response if the request waited too long while overloaded */
+    auto overloaded = [&](message *msg) -> message * {
+      if (!overload)
+        return nullptr;
+      auto delay = rte_get_timer_cycles() / get_ticks_us() - *msg->get_ts();
+      overload->record(delay);
+      if (!overload->reject(delay))
+        return nullptr;
+      return busy_response(*ctx->handler, msg, allocator.get());
+    };
+    /* answers single pkt requests the service calls idempotent in the rx
+     * path, without a slot; see basic_connection::process_incoming */
+    auto fast = [&](message *msg) -> message * {
+      if constexpr (requires { ctx->handler->idempotent(msg); }) {
+        if (!rt->fast_path || !ctx->handler->idempotent(msg) ||
+            (!own.empty() && ctx->handler->dispatch(msg)))
+          return nullptr;
+        if (auto *busy = overloaded(msg)) {
+          ++rejected;
+          return busy;
+        }
+        ++requests;
+        return ctx->handler->serve(msg, allocator.get());
+      } else {
+        return nullptr;
+      }
+    };
+    lcore_balance balance;
+    rt->resume(idx, manager);
+    while (rt->running.load(std::memory_order_acquire)) {
+      auto iteration_start = rte_get_timer_cycles();
+      auto rcvd = server->poll([&](server_slot &slot) {
+        auto *msg = slot.rx_if.read();
+        if (!msg)
+          return;
+        if (auto *busy = overloaded(msg)) {
+          message_allocator::deallocate(msg);
+          respond(slot, busy);
+          ++rejected;
+          return;
+        }
+        if (!own.empty() && ctx->handler->dispatch(msg)) {
+          /* least loaded worker, fall back to inline if all are full */
+          auto *channel = *std::min_element(
+              own.begin(), own.end(), [](auto *a, auto *b) {
+                return a->outstanding() < b->outstanding();
+              });
+          if (channel->submit(&slot, msg)) {
+            slot.dispatched = true;
+            ++dispatched;
+            return;
+          }
+        }
+        auto *resp = ctx->handler->serve(msg, allocator.get());
+        message_allocator::deallocate(msg);
+        respond(slot, resp);
+        ++requests;
+      }, fast);
+      for (auto *channel : own)
+        channel->complete(on_complete);
+      server->complete();
+      if (overload &&
+          overload->update(iteration_start / get_ticks_us(),
+                           manager.connection_count()))
+        manager.limit_grants(overload->grant(manager.connection_count()));
+      if (rt->migration)
+        rt->rebalance(idx, balance, manager, iteration_start, rcvd);
+      rt->stats[idx].requests.store(requests, std::memory_order_relaxed);
+      rt->stats[idx].dispatched.store(dispatched, std::memory_order_relaxed);
+      rt->stats[idx].rejected.store(rejected, std::memory_order_relaxed);
+    }
+    auto stopped = restart::monotonic_ns();
+    /* collect what the workers still hold before the slots go away */
+    for (auto *channel : own) {
+      while (channel->outstanding()) {
+        channel->complete(on_complete);
+        rte_pause();
+      }
+      channel->close();
+    }
+    server->complete();
+    rt->suspend(idx, manager, stopped);
+    return 0;
+  }
+
+  template <typename S> static int worker_main(context<S> *ctx, uint16_t w) {
+    auto *channel = ctx->runtime->channels[w].get();
+    auto *allocator = ctx->runtime->worker_allocators[w].get();
+    auto serve = [&](message *msg) {
+      auto *resp = ctx->handler->serve(msg, allocator);
+      message_allocator::deallocate(msg);
+      return resp;
+    };
+    while (!channel->drained())
+      if (!channel->serve(serve))
+        rte_pause();
+    return 0;
+  }
+
+  con_config scon_config;
+  backend_factory factory;
+  uint16_t workers;
+  std::vector<std::unique_ptr<dispatch_channel>> channels;
+  std::vector<std::shared_ptr<message_allocator>> worker_allocators;
+  std::vector<std::shared_ptr<message_allocator>> allocators;
+  /* socket of every lcore by lcore index */
+  std::vector<int> sockets;
+  /* I/O lcore serving each worker's channel */
+  std::vector<uint16_t> worker_owner;
+  std::optional<migration_policy> migration;
+  server_connection_manager::poll_limits limits;
+  std::optional<overload_control::config> overload_config;
+  bool fast_path = false;
+  bool restore = false;
+  std::atomic<bool> handing_over{false};
+  std::vector<rte_ring *> inboxes;
+  std::vector<lcore_stats> stats;
+  std::atomic<bool> running{false};
+  uint64_t start = 0, end = 0;
+};
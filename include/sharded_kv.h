@@ -0,0 +1,167 @@
+#pragma once
+
+#include "client.h"
+#include "kv.h"
+#include "message.h"
+#include "transaction.h"
+#include "util.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <rte_ether.h>
+#include <span>
+#include <utility>
+#include <vector>
+
+/* Consistent hash ring with kVirtualNodes points per shard, so adding or
+ * removing a shard only moves the keys next to its points. */
+class hash_ring {
+  static constexpr uint32_t kVirtualNodes = 64;
+
+public:
+  void add(uint32_t shard, const con_config &server) {
+    for (uint32_t i = 0; i < kVirtualNodes; ++i)
+      points.emplace_back(jhash_3words(server.ip, server.port, i), shard);
+    std::sort(points.begin(), points.end());
+  }
+
+  void remove(uint32_t shard) {
+    std::erase_if(points, [&](auto &point) { return point.second == shard; });
+  }
+
+  /* shard owning key, the ring must not be empty */
+  uint32_t lookup(int64_t key) const {
+    assert(!points.empty());
+    auto hash = calc_hash(static_cast<uint64_t>(key));
+    auto it = std::lower_bound(points.begin(), points.end(),
+                               std::pair<uint32_t, uint32_t>(hash, 0));
+    return it == points.end() ? points.front().second : it->second;
+  }
+
+  bool empty() const { return points.empty(); }
+
+private:
+  /* (hash, shard) sorted by hash */
+  std::vector<std::pair<uint32_t, uint32_t>> points;
+};
+
+/* KV client of one lcore over a fleet of servers. Keys are routed with a
+ * hash_ring, requests to all shards are pipelined over one
+ * completion_queue and a single poll loop. A server joins the ring once its
+ * connection is up; a removed one keeps its connection, so its requests in
+ * flight still complete and adding it back reuses it. */
+class sharded_kv_client {
+public:
+  sharded_kv_client(client_iface &cif, message_allocator *allocator)
+      : cif(cif), allocator(allocator), cq(cif.get_manager()) {
+    cq.enable_stale_filter({kv_stamp_generation, kv_has_generation});
+  }
+
+  /* connects to server, its keys move over after the connection is set up;
+   * a server already on the ring stays as it is */
+  bool add_server(const con_config &server, rte_ether_addr mac) {
+    auto *shard = find(server);
+    if (shard && shard->member)
+      return true;
+    if (!shard) {
+      auto *con = cif.open_connection(server, mac);
+      if (!con)
+        return false;
+      shard = &shards.emplace_back(server, con);
+    }
+    shard->joining = true;
+    return true;
+  }
+
+  /* moves the keys of server to the remaining ones */
+  void remove_server(const con_config &server) {
+    auto *shard = find(server);
+    if (!shard)
+      return;
+    shard->joining = false;
+    if (std::exchange(shard->member, false))
+      ring.remove(shard - shards.data());
+  }
+
+  /* false if no server is up or the shard has no free slot */
+  bool get(int64_t key, uint64_t tag) {
+    auto *req = alloc_request();
+    if (!req)
+      return false;
+    create_get_request(req, key);
+    return submit(key, req, tag);
+  }
+
+  bool put(int64_t key, int64_t val, uint64_t tag) {
+    auto *req = alloc_request();
+    if (!req)
+      return false;
+    create_put_request(req, key, val);
+    return submit(key, req, tag);
+  }
+
+  /* completions of all shards, see completion_queue::poll_completions */
+  std::size_t poll(std::span<completion> out) {
+    for (uint32_t i = 0; i < shards.size(); ++i) {
+      auto &shard = shards[i];
+      if (shard.joining && shard.con->active()) {
+        shard.joining = false;
+        shard.member = true;
+        ring.add(i, shard.server);
+      }
+    }
+    return cq.poll_completions(out);
+  }
+
+  client_connection *route(int64_t key) const {
+    if (ring.empty())
+      return nullptr;
+    return shards[ring.lookup(key)].con;
+  }
+
+  uint32_t outstanding() const { return cq.outstanding(); }
+
+  std::size_t members() const {
+    return std::count_if(shards.begin(), shards.end(),
+                         [](auto &shard) { return shard.member; });
+  }
+
+private:
+  struct shard {
+    shard(const con_config &server, client_connection *con)
+        : server(server), con(con) {}
+
+    con_config server;
+    client_connection *con;
+    /* on the ring */
+    bool member = false;
+    /* to be put on the ring once the connection is up */
+    bool joining = false;
+  };
+
+  shard *find(const con_config &server) {
+    for (auto &shard : shards)
+      if (shard.server.ip == server.ip && shard.server.port == server.port)
+        return &shard;
+    return nullptr;
+  }
+
+  message *alloc_request() {
+    return allocator->alloc_message(sizeof(kv_packet<kv_request>));
+  }
+
+  bool submit(int64_t key, message *req, uint64_t tag) {
+    auto *con = route(key);
+    if (con && cq.submit(con, req, tag))
+      return true;
+    message_allocator::deallocate(req);
+    return false;
+  }
+
+  client_iface &cif;
+  message_allocator *allocator;
+  completion_queue cq;
+  std::vector<shard> shards;
+  hash_ring ring;
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "dev.h"
+#include "util.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <rte_mbuf.h>
+#include <rte_mempool.h>
+#include <sys/types.h>
+
+/* Single producer single consumer ring of whole frames living in memory
+ * shared between two processes. */
+struct alignas(RTE_CACHE_LINE_MIN_SIZE) shm_ring {
+  static constexpr uint32_t kSlots = 256;
+  static constexpr uint32_t kSlotSize = 2048;
+  struct slot {
+    uint32_t len;
+    uint8_t data[kSlotSize];
+  };
+
+  /* false if pkt is longer than max_len or the ring is full */
+  bool push(rte_mbuf *pkt);
+  rte_mbuf *pop(rte_mempool *pool);
+  bool empty() const {
+    return head.load(std::memory_order_relaxed) ==
+           tail.load(std::memory_order_acquire);
+  }
+  void reset() {
+    head.store(0, std::memory_order_relaxed);
+    tail.store(0, std::memory_order_relaxed);
+  }
+
+  /* longest frame the pool of the consumer holds, set by the consumer
+   * before the channel is claimed; push refuses longer ones */
+  uint32_t max_len;
+
+  alignas(RTE_CACHE_LINE_MIN_SIZE) std::atomic<uint32_t> head;
+  alignas(RTE_CACHE_LINE_MIN_SIZE) std::atomic<uint32_t> tail;
+  alignas(RTE_CACHE_LINE_MIN_SIZE) slot slots[kSlots];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "");
+
+/* Pair of rings between the owner of a region and one attached peer. */
+struct shm_channel {
+  enum : uint32_t { FREE = 0, CLAIMED = 1, SETUP = 2 };
+  std::atomic<uint32_t> state;
+  /* bumped by every claim, so the owner notices a new peer even if the
+   * channel was freed and claimed again between two of its polls */
+  uint32_t generation;
+  uint32_t ip;
+  uint16_t port;
+  /* process of the peer, the owner frees the channel once it is gone */
+  pid_t pid;
+  shm_ring to_owner;
+  shm_ring to_peer;
+};
+
+/* Every process publishes one region named after its own address, peers on
+ * the same host attach to it and claim a channel. The owner clears magic
+ * when it goes away; peers detach once magic is gone or pid has died, e.g.
+ * after a hot restart published a new region under the same name. */
+struct shm_region {
+  static constexpr uint32_t kMagic = 0x66617374;
+  static constexpr uint16_t kChannels = 16;
+  uint32_t magic;
+  uint32_t ip;
+  uint16_t port;
+  pid_t pid;
+  shm_channel channels[kChannels];
+};
+
+/* Sends frames to peers on the same host over shared memory and everything
+ * else through the wrapped backend. Whether a peer is local is decided from
+ * its address: it is if it published a region for it. The transport above is
+ * unaware of the switch, packets are still framed and acknowledged as usual.
+ * Without a wrapped backend non local pkts are dropped. */
+class shm_backend final : public dev_backend {
+  static constexpr uint16_t kMaxBurst = 64;
+  static constexpr uint16_t kPeerTableSize = 256;
+  /* how long a peer without a region is sent to through the nic */
+  static constexpr uint64_t kRetryMs = 1000;
+  /* how often the processes on the other side are checked for liveness */
+  static constexpr uint64_t kLivenessMs = 100;
+
+public:
+  static std::unique_ptr<dev_backend> create(std::unique_ptr<dev_backend> inner,
+                                             uint32_t ip, uint16_t port,
+                                             rte_mempool *pool);
+
+  uint16_t tx_burst(rte_mbuf **pkts, uint16_t cnt) override;
+  uint16_t rx_burst(rte_mbuf **pkts, uint16_t cnt) override;
+  void macaddr(rte_ether_addr *addr) override;
+
+  ~shm_backend() override;
+
+private:
+  struct peer {
+    shm_ring *tx = nullptr;
+    shm_ring *rx = nullptr;
+    shm_channel *channel = nullptr;
+    shm_region *region = nullptr;
+    uint64_t retry_at = 0;
+  };
+
+  shm_backend(std::unique_ptr<dev_backend> inner, uint32_t ip, uint16_t port,
+              rte_mempool *pool, shm_region *region)
+      : inner(std::move(inner)), peers(kPeerTableSize), own(region), ip(ip),
+        port(port), pool(pool) {}
+
+  static uint64_t key(uint32_t ip, uint16_t port) {
+    return static_cast<uint64_t>(ip) << 16 | port;
+  }
+  peer *route(rte_mbuf *pkt);
+  bool attach(peer &p, uint32_t ip, uint16_t port);
+  void detach(peer &p);
+  void check_liveness();
+  uint16_t poll_rings(rte_mbuf **pkts, uint16_t cnt);
+
+  std::unique_ptr<dev_backend> inner;
+  fixed_size_hash_table<uint64_t, peer> peers;
+  /* channels we attached to, polled for rx next to our own region */
+  std::array<peer *, kPeerTableSize> attached{};
+  uint16_t nattached = 0;
+  /* the claim of each channel of our region the peers table reflects */
+  struct claim {
+    bool live = false;
+    uint32_t generation = 0;
+    uint64_t key = 0;
+  };
+  std::array<claim, shm_region::kChannels> known{};
+  uint64_t next_check = 0;
+  shm_region *own;
+  uint32_t ip;
+  uint16_t port;
+  rte_mempool *pool;
+};
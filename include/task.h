@@ -0,0 +1,176 @@
+#pragma once
+
+#include "call.h"
+#include "connection.h"
+#include "transport/slot.h"
+#include <array>
+#include <bit>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+/* Coroutine frames of the calling lcore, in power of two size classes.
+ * Blocks are carved from chunks of kChunkBlocks and never given back, so
+ * once warmed up a task costs no heap allocation. Frames above kMaxBlock
+ * come from the heap. */
+class frame_pool {
+  static constexpr std::size_t kMinBlock = 64;
+  static constexpr std::size_t kMaxBlock = 4096;
+  static constexpr std::size_t kClasses =
+      std::countr_zero(kMaxBlock) - std::countr_zero(kMinBlock) + 1;
+  static constexpr std::size_t kChunkBlocks = 64;
+
+  struct free_block {
+    free_block *next;
+  };
+
+public:
+  static frame_pool &local() {
+    static thread_local frame_pool pool;
+    return pool;
+  }
+
+  void *alloc(std::size_t size) {
+    if (size > kMaxBlock)
+      return ::operator new(size);
+    auto &head = free[size_class(size)];
+    if (!head)
+      refill(size_class(size));
+    auto *block = head;
+    head = block->next;
+    return block;
+  }
+
+  void release(void *ptr, std::size_t size) {
+    if (size > kMaxBlock) {
+      ::operator delete(ptr);
+      return;
+    }
+    auto &head = free[size_class(size)];
+    head = new (ptr) free_block{head};
+  }
+
+private:
+  static std::size_t size_class(std::size_t size) {
+    return std::countr_zero(std::bit_ceil(std::max(size, kMinBlock))) -
+           std::countr_zero(kMinBlock);
+  }
+
+  void refill(std::size_t cls) {
+    auto block = kMinBlock << cls;
+    chunks.emplace_back(new std::byte[block * kChunkBlocks]);
+    auto *base = chunks.back().get();
+    for (std::size_t i = 0; i < kChunkBlocks; ++i)
+      free[cls] = new (base + i * block) free_block{free[cls]};
+  }
+
+  std::array<free_block *, kClasses> free{};
+  std::vector<std::unique_ptr<std::byte[]>> chunks;
+};
+
+class client_scheduler;
+
+/* Coroutine started with client_scheduler::spawn. The frame is released
+ * when the coroutine returns. */
+class task {
+public:
+  struct promise_type {
+    task get_return_object() {
+      return task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+
+    static void *operator new(std::size_t size) {
+      return frame_pool::local().alloc(size);
+    }
+    static void operator delete(void *ptr, std::size_t size) {
+      frame_pool::local().release(ptr, size);
+    }
+
+    ~promise_type();
+
+    client_scheduler *scheduler = nullptr;
+  };
+
+  task(task &&other) noexcept : handle(std::exchange(other.handle, {})) {}
+  task(const task &) = delete;
+  /* a task that was never spawned is dropped */
+  ~task() {
+    if (handle)
+      handle.destroy();
+  }
+
+private:
+  friend class client_scheduler;
+  explicit task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+/* Runs the client coroutines of one lcore: polls its manager, resumes the
+ * coroutines whose calls completed and retries the calls waiting for a
+ * slot or send window. Thousands of calls may be in flight, the poll only
+ * touches the completed ones. */
+class client_scheduler {
+public:
+  explicit client_scheduler(client_connection_manager &manager)
+      : manager(manager) {}
+
+  /* runs t up to its first co_await */
+  void spawn(task t) {
+    auto handle = std::exchange(t.handle, {});
+    handle.promise().scheduler = this;
+    ++tasks;
+    handle.resume();
+  }
+
+  /* one round, returns the number of pkts received */
+  uint32_t poll() {
+    auto rcvd = manager.poll([](client_slot &slot) {
+      /* pushes are for completion_queue users */
+      if (slot.is_push()) {
+        while (auto *msg = slot.rx_if.read())
+          rte_pktmbuf_free(msg);
+        slot.owner->acknowledge_all();
+        return;
+      }
+      if (auto waiter = std::exchange(slot.waiter, {}))
+        waiter.resume();
+    });
+    /* a call still blocked on one connection does not hold up the calls
+     * of the others */
+    auto &pending = pending_calls();
+    for (auto it = pending.begin(); it != pending.end();)
+      it = it->retry(&*it) ? pending.erase(it) : std::next(it);
+    manager.flush();
+    return rcvd;
+  }
+
+  /* polls until every spawned task returned */
+  void run() {
+    while (tasks)
+      poll();
+  }
+
+  uint32_t running() const { return tasks; }
+
+private:
+  friend struct task::promise_type;
+
+  client_connection_manager &manager;
+  uint32_t tasks = 0;
+};
+
+inline task::promise_type::~promise_type() {
+  if (scheduler)
+    --scheduler->tasks;
+}
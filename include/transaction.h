@@ -1,21 +1,29 @@
+#pragma once
+
 #include "client.h"
 #include "connection.h"
 #include "queue.h"
 #include "transport/slot.h"
+#include <algorithm>
+#include <array>
 #include <bit>
 #include <cstddef>
 #include <cstdint>
+#include <rte_mbuf.h>
+#include <rte_cycles.h>
 #include <rte_mbuf_core.h>
+#include <span>
+#include <utility>
 
 struct transaction_handle {
-  transaction_slot *slot;
+  client_slot *slot;
 };
 
 class transaction_queue {
 public:
   transaction_queue(std::size_t size) : queue(std::bit_ceil(size)) {}
 
-  transaction_handle *enqueue(transaction_slot *slot) {
+  transaction_handle *enqueue(client_slot *slot) {
     if (queue.full())
       return nullptr;
     return queue.enqueue(slot);
@@ -39,11 +47,11 @@ private:
 
 struct transaction_proxy {
   transaction_queue &q;
-  connection *con;
+  client_connection *con;
   transaction_handle *t;
   bool done = false;
 
-  transaction_proxy(transaction_queue &q, connection *con,
+  transaction_proxy(transaction_queue &q, client_connection *con,
                     transaction_handle *t)
       : q(q), con(con), t(t) {}
 
@@ -71,3 +79,321 @@ struct transaction_proxy {
 
   bool completed() const { return done; }
 };
+
+struct submission {
+  client_connection *con;
+  message *req;
+  uint64_t tag;
+};
+
+struct completion {
+  /* completion_queue::kPushTag for a push of the server */
+  uint64_t tag;
+  client_connection *con;
+  /* the pkts of a multi pkt response are chained, nullptr if the deadline
+   * passed first or they did not fit one chain (counters::unchained) */
+  message *resp;
+};
+
+/* Completion queue of the client connections of one lcore. Requests are
+ * submitted with a tag and poll_completions hands out whatever finished,
+ * in the order the responses completed on each connection, so a slow
+ * response holds up nobody behind it. The slot is returned on completion;
+ * completions that do not fit the caller's span wait on the slots' ready
+ * links, nothing is allocated.
+ *
+ * A request may carry a deadline, after which it completes without a
+ * response and its slot is cancelled. With hedging enabled a request that
+ * names a second connection is duplicated there once it runs longer than
+ * a percentile of the recent latencies, the first response wins and the
+ * other slot is cancelled.
+ *
+ * A slot freed by a cancel timeout may still get the late response of the
+ * request it gave up on. It is only handed out again once that arrived,
+ * unless the protocol on top supplies a stale_filter: then its next
+ * request is stamped with the slot's generation, which the server has to
+ * echo, and responses without it are dropped.
+ *
+ * Pushes of the servers, see basic_connection::push, come out as
+ * completions tagged kPushTag, one per message; they take no slot and do
+ * not count as outstanding. */
+class completion_queue {
+  static constexpr uint32_t kBuckets = 64;
+
+public:
+  static constexpr uint64_t kPushTag = UINT64_MAX;
+
+  struct options {
+    /* microseconds until the request is given up, 0 for none */
+    uint64_t deadline_us = 0;
+    /* where the duplicate goes, see enable_hedging */
+    client_connection *hedge = nullptr;
+  };
+
+  struct hedge_config {
+    /* requests still running at this latency percentile are duplicated */
+    double percentile = 0.95;
+    /* histogram resolution; the threshold is recomputed every period
+     * samples, no request is duplicated before the first */
+    uint64_t bucket_us = 10;
+    uint32_t period = 4096;
+  };
+
+  struct counters {
+    uint64_t completed = 0, expired = 0, hedged = 0, hedge_wins = 0;
+    uint64_t pushes = 0;
+    /* responses dropped for having more pkts than one mbuf chain holds */
+    uint64_t unchained = 0;
+  };
+
+  /* stamp writes a slot generation into a request, matches tells whether
+   * a response carries it, see kv_stamp_generation */
+  struct stale_filter {
+    void (*stamp)(message *req, uint64_t generation);
+    bool (*matches)(message *resp, uint64_t generation);
+  };
+
+  explicit completion_queue(client_connection_manager &manager)
+      : manager(manager) {}
+
+  void enable_hedging(const hedge_config &conf) {
+    hedge_conf = conf;
+    hedging = true;
+  }
+
+  void enable_stale_filter(const stale_filter &f) { filter = f; }
+
+  bool submit(client_connection *con, message *req, uint64_t tag) {
+    return submit(con, req, tag, options{});
+  }
+
+  /* false if con has no free slot or send window, req is not consumed */
+  bool submit(client_connection *con, message *req, uint64_t tag,
+              const options &opts) {
+    auto *slot = con->start_transaction(takes_stale());
+    if (!slot)
+      return false;
+    stamp(*slot, req);
+    /* the transport prepends its headers to req, the duplicate needs a copy
+     * taken before */
+    message *copy = nullptr;
+    if (hedging && opts.hedge && opts.hedge != con)
+      copy = static_cast<message *>(
+          rte_pktmbuf_copy(req, req->pool, 0, UINT32_MAX));
+    if (!slot->tx_if.send(req, true)) {
+      rte_pktmbuf_free(copy);
+      con->abort_transaction(slot);
+      return false;
+    }
+    slot->tag = tag;
+    slot->submitted = rte_get_timer_cycles();
+    if (opts.deadline_us)
+      slot->set_deadline(opts.deadline_us);
+    if (copy) {
+      slot->hedge_req = copy;
+      slot->hedge_con = opts.hedge;
+      hedges.push_back(*slot);
+    }
+    ++inflight;
+    return true;
+  }
+
+  /* Submits a prefix of subs, returns its length. Consecutive submissions
+   * to the same connection go out as one burst. */
+  std::size_t submit_burst(std::span<const submission> subs) {
+    std::size_t done = 0;
+    auto now = rte_get_timer_cycles();
+    while (done < subs.size()) {
+      auto *con = subs[done].con;
+      tx_entry entries[client_transport::kMaxBurst];
+      client_slot *slots[client_transport::kMaxBurst];
+      uint16_t n = 0;
+      while (done + n < subs.size() && n < client_transport::kMaxBurst &&
+             subs[done + n].con == con) {
+        auto *slot = con->start_transaction(takes_stale());
+        if (!slot)
+          break;
+        slot->tag = subs[done + n].tag;
+        slot->submitted = now;
+        stamp(*slot, subs[done + n].req);
+        slots[n] = slot;
+        entries[n] = {subs[done + n].req, slot->tid, true};
+        ++n;
+      }
+      auto sent = n ? con->send_burst(entries, n) : 0;
+      for (auto i = sent; i < n; ++i)
+        con->abort_transaction(slots[i]);
+      inflight += sent;
+      done += sent;
+      if (sent < n || n == 0)
+        break;
+    }
+    return done;
+  }
+
+  /* fills out with up to out.size() completions, returns their number */
+  std::size_t poll_completions(std::span<completion> out) {
+    std::size_t n = 0;
+    while (n < out.size() && !overflow.empty()) {
+      auto &slot = overflow.front();
+      overflow.pop_front();
+      n += complete(slot, out[n]);
+    }
+    if (n < out.size()) {
+      fire_hedges();
+      manager.poll([&](client_slot &slot) {
+        if (n < out.size())
+          n += complete(slot, out[n]);
+        else
+          overflow.push_back(slot);
+      });
+      manager.flush();
+    }
+    return n;
+  }
+
+  uint32_t outstanding() const { return inflight; }
+
+  const counters &get_counters() const { return stats; }
+
+private:
+  /* false if the slot only got a stale response */
+  bool complete(client_slot &slot, completion &out) {
+    if (slot.is_push()) {
+      out = deliver(slot);
+      return true;
+    }
+    if (slot.stale && !slot.expired && drop_stale(slot))
+      return false;
+    out = finish(slot);
+    return true;
+  }
+
+  completion finish(client_slot &slot) {
+    auto *con = slot.owner;
+    auto tag = slot.tag;
+    release(slot);
+    --inflight;
+    if (slot.expired) {
+      ++stats.expired;
+      con->cancel_transaction(&slot);
+      return {tag, con, nullptr};
+    }
+    auto *resp = slot.rx_if.read_all();
+    if (!resp)
+      ++stats.unchained;
+    record(rte_get_timer_cycles() - slot.submitted);
+    ++stats.completed;
+    if (slot.is_hedge)
+      ++stats.hedge_wins;
+    con->finish_transaction(&slot);
+    return {tag, con, resp};
+  }
+
+  /* stale slots are only safe to reuse if their responses can be told
+   * apart */
+  bool takes_stale() const { return filter.stamp != nullptr; }
+
+  void stamp(client_slot &slot, message *req) {
+    if (slot.stale)
+      filter.stamp(req, ++slot.generation);
+  }
+
+  /* true if the response of a stale slot answers the request it gave up
+   * on; the slot keeps waiting then */
+  bool drop_stale(client_slot &slot) {
+    slot.stale = false;
+    auto *resp = slot.incoming.front();
+    if (filter.matches(resp, slot.generation))
+      return false;
+    while (auto *msg = slot.rx_if.read())
+      rte_pktmbuf_free(msg);
+    slot.await_again();
+    return true;
+  }
+
+  /* one push at a time, the slot stays queued while it has more */
+  completion deliver(client_slot &slot) {
+    auto *msg = slot.rx_if.read();
+    if (slot.rx_if.has_incoming_messages())
+      overflow.push_back(slot);
+    else
+      slot.owner->acknowledge_all();
+    ++stats.pushes;
+    return {kPushTag, slot.owner, msg};
+  }
+
+  /* frees the kept copy of the request and cancels the other slot */
+  void release(client_slot &slot) {
+    rte_pktmbuf_free(std::exchange(slot.hedge_req, nullptr));
+    if (auto *twin = std::exchange(slot.twin, nullptr)) {
+      twin->twin = nullptr;
+      twin->owner->cancel_transaction(twin);
+    }
+  }
+
+  /* duplicates the requests running longer than the threshold; they are
+   * queued in submission order, so only the front needs checking */
+  void fire_hedges() {
+    if (!threshold)
+      return;
+    auto now = rte_get_timer_cycles();
+    while (!hedges.empty()) {
+      auto &slot = hedges.front();
+      if (now - slot.submitted < threshold)
+        break;
+      hedges.pop_front();
+      auto *req = std::exchange(slot.hedge_req, nullptr);
+      auto *con = slot.hedge_con;
+      auto *dup = con->active() ? con->start_transaction(takes_stale())
+                                : nullptr;
+      if (!dup) {
+        rte_pktmbuf_free(req);
+        continue;
+      }
+      stamp(*dup, req);
+      if (!dup->tx_if.send(req, true)) {
+        rte_pktmbuf_free(req);
+        con->abort_transaction(dup);
+        continue;
+      }
+      dup->tag = slot.tag;
+      dup->submitted = slot.submitted;
+      dup->is_hedge = true;
+      dup->twin = &slot;
+      slot.twin = dup;
+      ++stats.hedged;
+    }
+  }
+
+  void record(uint64_t cycles) {
+    if (!hedging)
+      return;
+    auto us = cycles / get_ticks_us();
+    ++histogram[std::min<uint64_t>(us / hedge_conf.bucket_us, kBuckets - 1)];
+    if (++samples < hedge_conf.period)
+      return;
+    auto target = static_cast<uint64_t>(samples * hedge_conf.percentile);
+    uint64_t seen = 0;
+    uint32_t i = 0;
+    while (i < kBuckets - 1 && (seen += histogram[i]) <= target)
+      ++i;
+    threshold = (i + 1) * hedge_conf.bucket_us * get_ticks_us();
+    histogram.fill(0);
+    samples = 0;
+  }
+
+  client_connection_manager &manager;
+  intrusive_list_t<client_slot, &client_slot::ready_link> overflow;
+  intrusive_list_t<client_slot, &client_slot::hedge_link> hedges;
+  uint32_t inflight = 0;
+  counters stats;
+  hedge_config hedge_conf;
+  bool hedging = false;
+  stale_filter filter{};
+  /* timer cycles after which a request is duplicated, 0 before the first
+   * period */
+  uint64_t threshold = 0;
+  std::array<uint64_t, kBuckets> histogram{};
+  uint64_t samples = 0;
+};
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <bit>
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/* Word level helpers for the receive window and SACK bitmaps. Bit i of a
+ * bitmap is bit (i & 63) of word (i / 64). */
+namespace bitmap {
+
+static constexpr uint32_t kWordBits = 64;
+
+__inline constexpr uint32_t words_for(uint32_t bits) {
+  return (bits + kWordBits - 1) / kWordBits;
+}
+
+/* mask of the valid bits in word w of a bitmap of len bits */
+__inline constexpr uint64_t valid_mask(uint32_t w, uint32_t len) {
+  auto rem = len - w * kWordBits;
+  return rem >= kWordBits ? ~0ull : (1ull << rem) - 1;
+}
+
+/* Copies len bits starting at bit start of a ring of nwords (power of two)
+ * words to out, so bit start ends up as bit 0. Bits beyond len are cleared. */
+__inline void rotated_copy(const uint64_t *ring, uint32_t nwords,
+                           uint32_t start, uint32_t len, uint64_t *out) {
+  auto w = start / kWordBits;
+  auto shift = start & (kWordBits - 1);
+  auto mask = nwords - 1;
+  auto n = words_for(len);
+  for (uint32_t i = 0; i < n; ++i, w = (w + 1) & mask) {
+    auto lo = ring[w] >> shift;
+    auto hi = shift ? ring[(w + 1) & mask] << (kWordBits - shift) : 0;
+    out[i] = lo | hi;
+  }
+  if (n)
+    out[n - 1] &= valid_mask(n - 1, len);
+}
+
+namespace detail {
+#if defined(__x86_64__)
+[[gnu::target("avx2")]] inline uint32_t skip_full_avx2(const uint64_t *words,
+                                                       uint32_t w,
+                                                       uint32_t n) {
+  const __m256i ones = _mm256_set1_epi64x(-1);
+  for (; w + 4 <= n; w += 4) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(words + w));
+    if (!_mm256_testc_si256(v, ones))
+      break;
+  }
+  return w;
+}
+
+inline const bool has_avx2 = [] {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") != 0;
+}();
+#endif
+
+/* first word >= w in [w, n) that is not all ones, n if there is none */
+__inline uint32_t skip_full(const uint64_t *words, uint32_t w, uint32_t n) {
+#if defined(__x86_64__)
+  if (has_avx2)
+    w = skip_full_avx2(words, w, n);
+#endif
+  while (w < n && words[w] == ~0ull)
+    ++w;
+  return w;
+}
+} // namespace detail
+
+/* calls f(i) for every cleared bit i < len */
+template <typename F>
+__inline void for_each_zero(const uint64_t *words, uint32_t len, F &&f) {
+  auto n = words_for(len);
+  /* the last word is partially valid, handle it outside the fast skip */
+  auto full = len / kWordBits;
+  for (uint32_t w = detail::skip_full(words, 0, full); w < n;
+       w = detail::skip_full(words, w + 1, full)) {
+    auto zeros = ~words[w] & valid_mask(w, len);
+    while (zeros) {
+      f(w * kWordBits + std::countr_zero(zeros));
+      zeros &= zeros - 1;
+    }
+  }
+}
+
+/* highest set bit in [from, len), -1 if there is none */
+__inline int64_t highest_set(const uint64_t *words, uint32_t from,
+                             uint32_t len) {
+  if (from >= len)
+    return -1;
+  for (auto w = words_for(len); w-- > from / kWordBits;) {
+    auto bits = words[w] & valid_mask(w, len);
+    if (w == from / kWordBits)
+      bits &= ~0ull << (from & (kWordBits - 1));
+    if (bits)
+      return w * kWordBits + (kWordBits - 1 - std::countl_zero(bits));
+  }
+  return -1;
+}
+
+} // namespace bitmap
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+/* Compile time role and feature selection for transaction slots, transports
+ * and connections. Every binary instantiates the stack for the role it
+ * plays, so the hot path carries no role or feature checks. */
+template <bool Client, bool Sack = true, bool PiggybackAck = true>
+struct transport_policy {
+  static constexpr bool is_client = Client;
+  /* selective acks for windows with holes, cumulative acks only otherwise */
+  static constexpr bool sack = Sack;
+  /* acks ride on outgoing messages when one is pending */
+  static constexpr bool piggyback_ack = PiggybackAck;
+  /* slot timer period in ms, the client waits for the server's */
+  static constexpr uint64_t kSlotTimeoutMs = Client ? 2 : 1;
+};
+
+using client_policy = transport_policy<true>;
+using server_policy = transport_policy<false>;
@@ -1,14 +1,18 @@
 #pragma once
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <message.h>
 #include <rte_cycles.h>
 
+#include "bitmap.h"
 #include "debug.h"
 #include "filter.h"
 #include "message.h"
 #include "protocol.h"
 #include "queue.h"
+#include "restart.h"
 #include "util.h"
 
 static constexpr uint64_t min_seq = 1;
@@ -18,12 +22,10 @@ struct sender_entry {
   message *packet;
   uint64_t seq;
   uint16_t tid : 14;
-  uint16_t sacked : 1;
   uint16_t retransmitted : 1;
   sender_entry() : packet(nullptr), seq(0), retransmitted(false) {}
   sender_entry(message *packet, uint64_t seq, uint16_t tid, bool retransmitted)
-      : packet(packet), seq(seq), tid(tid), sacked(false),
-        retransmitted(retransmitted) {}
+      : packet(packet), seq(seq), tid(tid), retransmitted(retransmitted) {}
 
   bool requires_retry(uint64_t now, uint64_t rto) {
     return now > *packet->get_ts() + rto;
@@ -59,16 +61,39 @@ public:
   }
 
   template <typename F> bool record_pkt(uint16_t tid, message *msg, F &&ctor) {
-    if (unacked_packets.full() || budget == 0)
+    if (!reserve(1))
       return false;
-    --budget;
+    record_reserved(tid, msg, ctor);
+    return true;
+  }
+
+  /* takes room for up to n pkts out of the queue and the budget at once,
+   * each has to be recorded with record_reserved */
+  uint16_t reserve(uint16_t n) {
+    n = std::min<std::size_t>({n, unacked_packets.space(), budget});
+    budget -= n;
+    return n;
+  }
+
+  /* a pkt would fit the queue and the budget now */
+  bool can_send() { return unacked_packets.space() && budget; }
+
+  template <typename F>
+  void record_reserved(uint16_t tid, message *msg, F &&ctor) {
     ctor(msg, seq);
     msg->inc_refcnt();
     *msg->get_ts() = 0;
     auto *entry = unacked_packets.enqueue(msg, seq++, tid, false);
     send_list.push_front(*entry);
     FASTT_LOG_DEBUG("Enqueue pkt with %lu new budget %u\n", seq - 1, budget);
-    return true;
+  }
+
+  /* some pkt of tid has not been acked yet */
+  bool unacked(uint16_t tid) {
+    for (std::size_t i = 0; i < unacked_packets.size(); ++i)
+      if (unacked_packets[i].tid == tid)
+        return true;
+    return false;
   }
 
   template <typename F> void probe_retransmit(F &&cb, uint16_t tid) {
@@ -76,7 +101,7 @@ public:
       auto *msg = entry.packet;
       if (*msg->get_ts() == 0)
         break;
-      if (entry.tid != tid || entry.sacked)
+      if (entry.tid != tid || entry.seq < sacked_until)
         continue;
       FASTT_LOG_DEBUG("Retransmitting packet: %lu\n", entry.seq);
       prepare_retransmit(&entry);
@@ -111,25 +136,33 @@ public:
   template <typename F>
   void acknowledge_sack(protocol::ft_sack_payload *payload, uint64_t budget,
                         uint64_t now, F &&retransmit_cb) {
-    auto pkt_seq = least_unacked_pkt;
-    uint64_t largest_acked = 0;
-    assert(payload->bit_map_len > 0);
-    assert(payload->bit_map_len <= unacked_packets.size());
+    uint64_t words[protocol::ft_sack_payload::kBitMapLen];
+    std::memcpy(words, payload->bit_map, sizeof(words));
+    acknowledge_sack(words, payload->bit_map_len, budget, now, retransmit_cb);
+  }
+
+  /* bit i of words covers least_unacked_pkt + i. Holes are retransmitted,
+   * the whole range counts as sacked afterwards. */
+  template <typename F>
+  void acknowledge_sack(const uint64_t *words, uint32_t len, uint64_t budget,
+                        uint64_t now, F &&retransmit_cb) {
+    assert(len > 0);
+    assert(len <= unacked_packets.size());
     assert(unacked_packets.front()->seq == least_unacked_pkt);
-    for (auto i = 0u; i < payload->bit_map_len; ++i, ++pkt_seq) {
-      auto ind = get_bit_indices_64(i);
-      auto val = payload->bit_map[ind.first] & (1 << ind.second);
+    bitmap::for_each_zero(words, len, [&](uint32_t i) {
       auto &desc = unacked_packets[i];
-
-      if (!val) {
-        prepare_retransmit(&desc);
-        retransmit_cb(desc.packet);
-      } else if (!desc.sacked)
-        /* we want the largest seq not acked yet */
-        largest_acked = pkt_seq;
-
-      desc.sacked = true;
-    }
+      prepare_retransmit(&desc);
+      retransmit_cb(desc.packet);
+    });
+    /* we want the largest seq not sacked before */
+    auto from = sacked_until > least_unacked_pkt
+                    ? sacked_until - least_unacked_pkt
+                    : 0;
+    auto largest = bitmap::highest_set(words, from, len);
+    sacked_until = std::max(sacked_until, least_unacked_pkt + len);
+    if (largest < 0)
+      return;
+    uint64_t largest_acked = least_unacked_pkt + largest;
     FASTT_LOG_DEBUG("Largest set seq num %lu\n", largest_acked);
     update_srtt(largest_acked, now);
     update_budget(budget, largest_acked);
@@ -148,17 +181,87 @@ public:
   }
 
   uint64_t get_seq() const { return seq; }
+  uint64_t get_least_unacked() const { return least_unacked_pkt; }
+
+  /* resends the unacked pkts in [from, to] that went out before, returns
+   * how many */
+  template <typename F>
+  uint32_t retransmit_range(uint64_t from, uint64_t to, F &&cb) {
+    uint32_t sent = 0;
+    for (auto s = std::max(from, least_unacked_pkt); s <= to && s < seq; ++s) {
+      auto &desc = unacked_packets[s - least_unacked_pkt];
+      if (*desc.packet->get_ts() == 0)
+        continue;
+      prepare_retransmit(&desc);
+      cb(desc.packet);
+      ++sent;
+    }
+    return sent;
+  }
   uint64_t get_srtt() const { return rtt; }
 
   bool all_acked() const { return least_unacked_pkt == seq; }
 
   void update_budget(uint16_t granted, uint64_t ack) {
-    budget = (granted - (seq - ack - 1));
+    /* the grant may shrink below what is already in flight */
+    auto inflight = seq - ack - 1;
+    budget = granted > inflight ? granted - inflight : 0;
     FASTT_LOG_DEBUG("Got new capacity %u\n", budget);
   }
 
   const statistics &get_stats() const { return stats; }
 
+  /* unacked pkts are written without their first skip bytes, the L2-L4
+   * headers that belong to the sending process */
+  void save(restart::writer &w, uint16_t skip) {
+    w.put(stats);
+    w.put(budget);
+    w.put(seq);
+    w.put(least_unacked_pkt);
+    w.put(sacked_until);
+    w.put(rtt);
+    w.put(static_cast<uint32_t>(unacked_packets.size()));
+    for (std::size_t i = 0; i < unacked_packets.size(); ++i) {
+      auto &entry = unacked_packets[i];
+      w.put(entry.seq);
+      w.put(static_cast<uint16_t>(entry.tid));
+      w.put(static_cast<bool>(entry.retransmitted));
+      w.put_msg(entry.packet, skip);
+    }
+  }
+
+  /* Counterpart of save on a fresh handler. Every unacked pkt is handed to
+   * transmit(msg), which sends it again with new headers. */
+  template <typename F>
+  bool restore(restart::reader &r, message_allocator *allocator,
+               F &&transmit) {
+    uint32_t unacked;
+    if (!r.get(stats) || !r.get(budget) || !r.get(seq) ||
+        !r.get(least_unacked_pkt) || !r.get(sacked_until) || !r.get(rtt) ||
+        !r.get(unacked))
+      return false;
+    for (uint32_t i = 0; i < unacked; ++i) {
+      uint64_t pkt_seq;
+      uint16_t tid;
+      bool retransmitted;
+      if (!r.get(pkt_seq) || !r.get(tid) || !r.get(retransmitted))
+        return false;
+      auto *msg = r.get_msg(allocator);
+      if (!msg)
+        return false;
+      auto *entry =
+          unacked_packets.enqueue(msg, pkt_seq, tid, retransmitted);
+      if (!entry) {
+        rte_pktmbuf_free(msg);
+        return false;
+      }
+      msg->inc_refcnt();
+      send_list.push_front(*entry);
+      transmit(msg);
+    }
+    return true;
+  }
+
 private:
   struct timeout {
     uint64_t rto;
@@ -174,5 +277,7 @@ private:
   uint32_t budget;
   uint64_t seq;
   uint64_t least_unacked_pkt = min_seq;
+  /* entries below were covered by a sack, timeouts leave them alone */
+  uint64_t sacked_until = min_seq;
   uint64_t rtt;
 };
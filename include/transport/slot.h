@@ -1,76 +1,142 @@
 #pragma once
 
 #include "message.h"
+#include "policy.h"
 #include "timer.h"
 #include "transport.h"
 #include "util.h"
 #include "timer.h"
+#include <algorithm>
+#include <coroutine>
 #include <cstdint>
 #include <deque>
 #include <rte_cycles.h>
 #include <rte_eal.h>
 #include <rte_lcore.h>
+#include <utility>
+
+template <typename P> class basic_connection;
 
 enum class slot_state {
   COMPLETED,
   RUNNING,
 };
 
-struct transaction_slot {
+template <typename P> struct basic_transaction_slot {
   static constexpr uint32_t kOutStandingMsg = 64;
   std::deque<message *> incoming;
   list_hook link;
-  transport *transport_impl;
+  /* queued on the ready list of its connection */
+  list_hook ready_link;
+  basic_transport<P> *transport_impl;
+  basic_connection<P> *owner;
   uint64_t incoming_pkts = 0;
-  const uint64_t default_timeout;
+  const uint64_t timeout;
   timer<dpdk_timer> slot_timer;
   uint16_t tid = 0;
   slot_state state = slot_state::COMPLETED;
-  bool is_client = false;
   bool has_outstanding_msgs = false;
-
-  transaction_slot(uint16_t tid, transport *transport_impl, bool is_client)
-      : transport_impl(transport_impl), default_timeout(get_ticks_ms()), slot_timer(timertype::SINGLE),
-        tid(tid), is_client(is_client) {
-  }
+  /* handed to a worker lcore, not polled until the response is back */
+  bool dispatched = false;
+  /* client coroutine waiting for the response, see call_awaiter */
+  std::coroutine_handle<> waiter;
+  /* user tag of a completion_queue submission */
+  uint64_t tag = 0;
+  /* the deadline passed before the response, not yet reported */
+  bool expired = false;
+  /* given up on; the slot is reused once the late response arrived or
+   * the cancel timeout passed, see basic_connection::cancel_transaction */
+  bool cancelled = false;
+  /* reused before the late response arrived: the next response may still
+   * be that one, see completion_queue */
+  bool stale = false;
+  /* stamped into the requests of a stale slot */
+  uint64_t generation = 0;
+  /* taken by start_transaction, not yet finished */
+  bool in_use = false;
+  uint64_t deadline_us = 0;
+  timer<dpdk_timer> deadline_timer;
+  /* hedging, see completion_queue: the other slot running the same
+   * request, the copy of the request kept for the duplicate and where it
+   * goes, and when the request was submitted in timer cycles */
+  list_hook hedge_link;
+  basic_transaction_slot *twin = nullptr;
+  message *hedge_req = nullptr;
+  basic_connection<P> *hedge_con = nullptr;
+  uint64_t submitted = 0;
+  bool is_hedge = false;
+
+  basic_transaction_slot(uint16_t tid, basic_transport<P> *transport_impl,
+                         basic_connection<P> *owner)
+      : transport_impl(transport_impl), owner(owner),
+        timeout(get_ticks_ms() * P::kSlotTimeoutMs),
+        slot_timer(timertype::SINGLE), tid(tid),
+        deadline_timer(timertype::SINGLE) {}
 
   static void timer_cb(rte_timer *timer, void *arg) {
     (void)timer;
-    auto *slot = static_cast<transaction_slot *>(arg);
+    auto *slot = static_cast<basic_transaction_slot *>(arg);
     slot->transport_impl->acknowledge();
     if (slot->incoming_pkts == 0)
       slot->transport_impl->probe_timeout(slot->tid);
     slot->rearm();
   }
 
+  static void deadline_cb(rte_timer *timer, void *arg) {
+    (void)timer;
+    auto *slot = static_cast<basic_transaction_slot *>(arg);
+    if (slot->completed() || slot->cancelled)
+      return;
+    slot->expired = true;
+    slot->owner->get_manager()->make_ready(*slot);
+  }
+
+  static void cancel_cb(rte_timer *timer, void *arg) {
+    (void)timer;
+    auto *slot = static_cast<basic_transaction_slot *>(arg);
+    slot->owner->give_up(slot);
+  }
+
+  /* the manager's poll hands the slot out expired after us microseconds */
+  void set_deadline(uint64_t us) {
+    deadline_us = us;
+    deadline_timer.reset(us * get_ticks_us(), deadline_cb, rte_lcore_id(),
+                         this);
+  }
+
+  /* give_up runs after ms unless the late response comes first */
+  void set_cancel_timeout(uint64_t ms) {
+    deadline_timer.reset(ms * get_ticks_ms(), cancel_cb, rte_lcore_id(), this);
+  }
+
   bool completed() { return state == slot_state::COMPLETED; }
 
+  /* receives the pushes of the server, see basic_connection::push */
+  bool is_push() const { return tid >= basic_transport<P>::kPushTidBase; }
+
   bool has_outstanding_messages() const {
     return has_outstanding_msgs || incoming.size() > 0;
   }
 
-  void handle_incoming_server(message *msg, bool fini) {
-    incoming.push_back(msg);
-    ++incoming_pkts;
-    has_outstanding_msgs = !fini;
-  }
-
-  void handle_incoming_client(message *msg, bool fini) {
+  /* the last pkt of a response completes a client slot, a server slot runs
+   * until the handler finishes it */
+  void handle_incoming(message *msg, bool fini) {
     incoming.push_back(msg);
     ++incoming_pkts;
-    if (fini) {
-      stop_timer();
-      state = slot_state::COMPLETED;
-      has_outstanding_msgs = false;
-    }
+    if constexpr (P::is_client) {
+      if (fini) {
+        stop_timer();
+        deadline_timer.stop();
+        state = slot_state::COMPLETED;
+        has_outstanding_msgs = false;
+      }
+    } else
+      has_outstanding_msgs = !fini;
   }
 
   void rearm() {
     incoming_pkts = 0;
-    auto timeout = default_timeout *
-                   (is_client ? 2 : 1); /* set timeout to 2ms/1ms */
     slot_timer.reset(timeout, timer_cb, rte_lcore_id(), this);
-
   }
 
   void stop_timer() {
@@ -91,10 +157,30 @@ struct transaction_slot {
     assert(state == slot_state::COMPLETED);
     state = slot_state::RUNNING;
     has_outstanding_msgs = true;
+    expired = cancelled = is_hedge = false;
+    in_use = true;
+    deadline_us = 0;
+    twin = nullptr;
+    hedge_req = nullptr;
+    hedge_con = nullptr;
     rearm();
   }
 
-  bool update_execution_state(intrusive_list_t<transaction_slot> &head) {
+  /* the response that completed the slot was the stale one, waits for the
+   * next within what is left of the deadline */
+  void await_again() {
+    state = slot_state::RUNNING;
+    has_outstanding_msgs = true;
+    rearm();
+    if (deadline_us) {
+      auto elapsed = (rte_get_timer_cycles() - submitted) / get_ticks_us();
+      auto left = deadline_us > elapsed ? deadline_us - elapsed : 1;
+      deadline_timer.reset(left * get_ticks_us(), deadline_cb, rte_lcore_id(),
+                           this);
+    }
+  }
+
+  bool update_execution_state(intrusive_list_t<basic_transaction_slot> &head) {
     if (state == slot_state::COMPLETED) {
       assert(!link.is_linked());
       head.push_front(*this);
@@ -115,15 +201,54 @@ struct transaction_slot {
       return msg;
     }
 
+    /* up to n messages into msgs, returns how many */
+    uint16_t read_burst(message **msgs, uint16_t n) {
+      n = std::min<std::size_t>(n, slot->incoming.size());
+      std::copy_n(slot->incoming.begin(), n, msgs);
+      slot->incoming.erase(slot->incoming.begin(), slot->incoming.begin() + n);
+      return n;
+    }
+
+    /* all messages chained into one, the pkts of a multi pkt message in
+     * order; nullptr if there are none or more pkts than one mbuf chain
+     * holds, they are freed then */
+    message *read_all() {
+      auto *msg = read();
+      while (auto *more = read()) {
+        if (msg && !rte_pktmbuf_chain(msg, more))
+          continue;
+        rte_pktmbuf_free(more);
+        rte_pktmbuf_free(std::exchange(msg, nullptr));
+      }
+      return msg;
+    }
+
     bool has_incoming_messages() { return slot->incoming.size() > 0; }
 
-    transaction_slot *slot;
+    basic_transaction_slot *slot;
   } rx_if{this};
 
   struct {
     bool send(message *msg, bool last = false) {
       return slot->transport_impl->send_pkt(msg, slot->tid, last);
     }
-    transaction_slot *slot;
+
+    /* sends buf without copying it, see message_allocator::alloc_external;
+     * if sending fails cb has already run when this returns */
+    bool send_external(void *buf, uint16_t len, external_completion_cb cb,
+                       void *arg, bool last = false) {
+      auto *msg = slot->transport_impl->get_allocator()->alloc_external(
+          buf, len, cb, arg);
+      if (!msg)
+        return false;
+      if (send(msg, last))
+        return true;
+      message_allocator::deallocate(msg);
+      return false;
+    }
+    basic_transaction_slot *slot;
   } tx_if{this};
 };
+
+using client_slot = basic_transaction_slot<client_policy>;
+using server_slot = basic_transaction_slot<server_policy>;
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
 #include <cassert>
 #include <cstdint>
 #include <message.h>
@@ -18,13 +20,23 @@
 
 #include "debug.h"
 #include "message.h"
+#include "numa.h"
 #include "packet_if.h"
+#include "policy.h"
 #include "protocol.h"
+#include "restart.h"
 #include "window.h"
 
 #include "retransmission_handler.h"
 #include "util.h"
 
+/* one pkt of a burst, see basic_transport::send_burst */
+struct tx_entry {
+  message *msg;
+  uint16_t msg_id;
+  bool last;
+};
+
 struct statistics {
   uint64_t retransmitted, acked, sent, retransmissions;
   double rtt;
@@ -70,18 +82,30 @@ struct ack_scheduler : public seq_observer<ack_scheduler> {
   ack_scheduler() : last_acked(0), last_sack(1), pending_from_retry(false) {}
 };
 
-class connection;
-class transport {
+template <typename P> class basic_connection;
+template <typename P> class basic_transport : public numa::placed {
   static constexpr uint16_t kOustandingMessages = 128;
-  friend class connection;
+  friend class basic_connection<P>;
   enum class connection_state { ESTABLISHING, ESTABLISHED, DISCONNECTING };
 public:
+  /* most pkts send_burst takes at once */
+  static constexpr uint16_t kMaxBurst = 64;
+  /* Tids of server initiated transactions follow those of the client's
+   * slots; the client offers kMaxPushTids of them in its FT_INIT and the
+   * server confirms how many it uses in the FT_INIT_ACK. */
+  static constexpr uint16_t kPushTidBase = kOustandingMessages;
+  static constexpr uint16_t kMaxPushTids = 16;
+  /* most pkts a peer may have outstanding, the receive window */
+  static constexpr uint16_t kMaxGrant = kOustandingMessages;
+
   struct {
     uint64_t sent = 0;
     uint64_t retransmissions = 0;
+    /* duplicate requests answered from the response cache */
+    uint64_t replayed = 0;
   } stats;
 
-  transport(message_allocator *allocator, packet_if *pkt_sink, uint16_t sport,
+  basic_transport(message_allocator *allocator, packet_if *pkt_sink, uint16_t sport,
             const con_config &target)
       : recv_wd(min_seq), target(target), rt_handler(), scheduler(),
         allocator(allocator), pkt_if(pkt_sink), sport(sport) {}
@@ -96,22 +120,82 @@ public:
     auto ctor = [&](message *pkt, uint64_t seq) {
       uint64_t ack = 0;
       uint32_t ts = 0;
-      auto least_in_window = recv_wd.get_last_acked_packet();
-      if (scheduler.ack_pending(least_in_window)) {
-        ack = least_in_window;
-        ts = recv_wd.get_ts();
-        scheduler.ack_callback(ack);
+      if constexpr (P::piggyback_ack) {
+        auto least_in_window = recv_wd.get_last_acked_packet();
+        if (scheduler.ack_pending(least_in_window)) {
+          ack = least_in_window;
+          ts = recv_wd.get_ts();
+          scheduler.ack_callback(ack);
+        }
       }
-      protocol::prepare_ft_header(pkt, seq, ack, msg_id, recv_wd.capacity(),
-                                  fini, ts);
+      protocol::prepare_ft_header(pkt, seq, ack, msg_id, grant(), fini, ts);
     };
 
+    auto seq = rt_handler.get_seq();
     auto inserted = rt_handler.record_pkt(msg_id, pkt, ctor);
-    if (inserted)
-      pkt_if->consume_pkt(pkt, sport, target);
+    if (inserted) {
+      if constexpr (!P::is_client)
+        if (msg_id < kPushTidBase)
+          note_response(msg_id, seq, fini);
+      transmit(pkt);
+    }
     return inserted;
   }
 
+  /* Sends entries[0, n) like send_pkt and returns how many went out, the
+   * rest did not fit the window. Window, ack and grant are looked at once
+   * per burst, the ft headers are copied from one prototype and the pkts
+   * go to the scheduler together. */
+  uint16_t send_burst(const tx_entry *entries, uint16_t n) {
+    assert(cstate == connection_state::ESTABLISHED);
+    n = rt_handler.reserve(std::min(n, kMaxBurst));
+    if (n == 0)
+      return 0;
+    protocol::ft_header proto{};
+    proto.type = protocol::FT_MSG;
+    proto.wnd = grant();
+    if constexpr (P::piggyback_ack) {
+      auto least_in_window = recv_wd.get_last_acked_packet();
+      if (scheduler.ack_pending(least_in_window)) {
+        proto.ack = least_in_window;
+        proto.ts = recv_wd.get_ts();
+        scheduler.ack_callback(least_in_window);
+      }
+    }
+    message *pkts[kMaxBurst];
+    for (uint16_t i = 0; i < n; ++i) {
+      auto &entry = entries[i];
+      auto seq = rt_handler.get_seq();
+      rt_handler.record_reserved(
+          entry.msg_id, entry.msg, [&](message *pkt, uint64_t seq) {
+            auto *ft = pkt->move_headroom<protocol::ft_header>();
+            *ft = proto;
+            ft->seq = seq;
+            ft->msg_id = entry.msg_id;
+            ft->fini = entry.last;
+          });
+      if constexpr (!P::is_client)
+        if (entry.msg_id < kPushTidBase)
+          note_response(entry.msg_id, seq, entry.last);
+      pkts[i] = entry.msg;
+    }
+    if (hdr_template.valid)
+      pkt_if->consume_burst(pkts, n, hdr_template);
+    else
+      for (uint16_t i = 0; i < n; ++i)
+        transmit(pkts[i]);
+    return n;
+  }
+
+  message_allocator *get_allocator() { return allocator; }
+
+  /* moves the connection to another lcore's packet_if and allocator; the
+   * header template stays valid, all lcores share the port and address */
+  void rebind(packet_if *pkt_sink, message_allocator *new_allocator) {
+    pkt_if = pkt_sink;
+    allocator = new_allocator;
+  }
+
   statistics get_stats() const {
     auto &rt_stats = rt_handler.get_stats();
     return {rt_stats.retransmitted, rt_stats.acked, stats.sent, stats.retransmissions,
@@ -122,10 +206,11 @@ public:
     message *msg;
     bool is_sack = false;
     uint64_t ack = recv_wd.get_last_acked_packet();
-    if (recv_wd.has_holes()) {
+    if constexpr (P::sack)
+      is_sack = recv_wd.has_holes();
+    if (is_sack) {
       if (!scheduler.sack_pending(ack))
         return false;
-      is_sack = true;
       msg = allocator->alloc_message(sizeof(protocol::ft_header) +
                                      sizeof(protocol::ft_sack_payload));
       auto *sack_payload = rte_pktmbuf_mtod_offset(
@@ -139,9 +224,9 @@ public:
       msg = allocator->alloc_message(sizeof(protocol::ft_header));
       scheduler.ack_callback(ack);
     }
-    protocol::prepare_ack_pkt(msg, ack, recv_wd.capacity(), recv_wd.get_ts(), is_sack);
-    FASTT_LOG_DEBUG("Return %u capacity to peer\n", recv_wd.capacity());
-    pkt_if->consume_pkt(msg, sport, target);
+    protocol::prepare_ack_pkt(msg, ack, grant(), recv_wd.get_ts(), is_sack);
+    FASTT_LOG_DEBUG("Return %u capacity to peer\n", grant());
+    transmit(msg);
     return true;
   }
 
@@ -155,21 +240,34 @@ public:
       scheduler.process_seq(hdr->seq);
       if (recv_wd.is_set(hdr->seq)) {
         ++stats.retransmissions;  
+        /* delivered before, so the peer lacks our answer or our ack */
+        if (hdr->seq < recv_wd.least_in_window) {
+          if constexpr (!P::is_client)
+            replay_response(hdr->msg_id, hdr->seq);
+          acknowledge();
+        }
         rte_pktmbuf_free(pkt);
         return false;
-      } else
-        recv_wd.set(hdr->seq, pkt);
+      }
+      if (!recv_wd.set(hdr->seq, pkt)) {
+        rte_pktmbuf_free(pkt);
+        return false;
+      }
+      if constexpr (!P::is_client)
+        note_request(hdr->msg_id, hdr->seq);
       break;
     }
     case protocol::pkt_type::FT_ACK: {
       rt_handler.acknowledge(hdr->ack, hdr->wnd, ts, hdr->sack);
-      if (hdr->sack) {
-        auto *sack_payload = rte_pktmbuf_mtod_offset(
-          pkt, protocol::ft_sack_payload *, sizeof(protocol::ft_header));  
-        rt_handler.acknowledge_sack(
-            sack_payload, hdr->wnd, ts,
-            [&](message *msg) { pkt_if->consume_for_retransmission(msg); });
-      }
+      /* without sack support holes are left to the retransmission timer */
+      if constexpr (P::sack)
+        if (hdr->sack) {
+          auto *sack_payload = rte_pktmbuf_mtod_offset(
+              pkt, protocol::ft_sack_payload *, sizeof(protocol::ft_header));
+          rt_handler.acknowledge_sack(
+              sack_payload, hdr->wnd, ts,
+              [&](message *msg) { pkt_if->consume_for_retransmission(msg); });
+        }
       rte_pktmbuf_free(pkt);
       break;
     }
@@ -179,6 +277,7 @@ public:
         return false;
       } else
         recv_wd.set(hdr->seq, pkt);
+      push_tids = std::min<uint16_t>(hdr->msg_id, kMaxPushTids);
       setup_after_init();
       cstate = connection_state::ESTABLISHED;
       break;
@@ -192,6 +291,7 @@ public:
       } else {
         recv_wd.set(hdr->seq, pkt);
       }
+      push_tids = std::min<uint16_t>(hdr->msg_id, kMaxPushTids);
       setup_after_init();
       cstate = connection_state::ESTABLISHED;
       break;
@@ -206,28 +306,53 @@ public:
   void open_connection() {
     auto *msg = allocator->alloc_message(sizeof(protocol::ft_header));
     bool retval = rt_handler.record_pkt(0, msg, [](message *msg, uint64_t seq) {
-      protocol::prepare_init_header(msg, seq);
+      protocol::prepare_init_header(msg, seq, P::is_client ? kMaxPushTids : 0);
     });
     assert(retval);
     auto *hdr = rte_pktmbuf_mtod(msg, protocol::ft_header *);
     assert(hdr->type == protocol::FT_INIT);
     FASTT_LOG_DEBUG("Sent init header to peer %u %u\n", target.ip, target.port);
-    pkt_if->consume_pkt(msg, sport, target);
+    pkt_if->build_template(hdr_template, sport, target);
+    transmit(msg);
   }
 
   void accept_connection() {
     auto *msg = allocator->alloc_message(sizeof(protocol::ft_header));
     bool retval = rt_handler.record_pkt(
-        0, msg, [budget = recv_wd.capacity()](message *msg, uint64_t seq) {
-          protocol::prepare_init_ack_header(msg, seq, min_seq, budget);
+        0, msg,
+        [budget = grant(), tids = push_tids](message *msg, uint64_t seq) {
+          protocol::prepare_init_ack_header(msg, seq, min_seq, budget, tids);
         });
     FASTT_LOG_DEBUG("Sent ack for init");
     assert(retval);
-    pkt_if->consume_pkt(msg, sport, target);
+    pkt_if->build_template(hdr_template, sport, target);
+    transmit(msg);
+  }
+
+  /* resends the INIT or INIT_ACK while the peer has not acked it */
+  bool retry_handshake() {
+    return rt_handler.retransmit_range(min_seq, min_seq, [&](message *msg) {
+      pkt_if->consume_for_retransmission(msg);
+    });
   }
 
   bool active() { return connection_state::ESTABLISHED == cstate; }
 
+  bool unacked(uint16_t tid) { return rt_handler.unacked(tid); }
+
+  /* the next send_pkt will go out */
+  bool can_send() { return rt_handler.can_send(); }
+
+  /* server initiated tids agreed on in the handshake */
+  uint16_t get_push_tids() const { return push_tids; }
+
+  /* caps the window granted to the peer, see overload_control */
+  void limit_grant(uint16_t limit) { grant_limit = limit; }
+
+  uint16_t grant() const {
+    return std::min<uint32_t>(recv_wd.capacity(), grant_limit);
+  }
+
   template <typename F> void receive_messages(F &&f) {
     grant_returned += recv_wd.advance(f);
     /* maybe we lost pkts */
@@ -238,11 +363,103 @@ public:
     }
   }
 
+  /* for a hot restart, see restart.h */
+  void save(restart::writer &w) {
+    w.put(cstate);
+    w.put(stats);
+    w.put(scheduler);
+    w.put(hdr_template);
+    w.put(grant_returned);
+    w.put(push_tids);
+    w.put(responses);
+    rt_handler.save(w, header_template::kSize);
+    recv_wd.save(w);
+  }
+
+  /* Counterpart of save on a transport that has not sent anything. The
+   * unacked pkts go out again right away, the peer drops duplicates. */
+  bool restore(restart::reader &r) {
+    if (!r.get(cstate) || !r.get(stats) || !r.get(scheduler) ||
+        !r.get(hdr_template) || !r.get(grant_returned) || !r.get(push_tids) ||
+        !r.get(responses))
+      return false;
+    if (hdr_template.valid) {
+      /* the arp entry of the old process is gone */
+      auto *eth = reinterpret_cast<rte_ether_hdr *>(hdr_template.hdr);
+      pkt_if->add_mapping(target.ip, eth->dst_addr);
+    }
+    return rt_handler.restore(r, allocator,
+                              [&](message *msg) { transmit(msg); }) &&
+           recv_wd.restore(r, allocator);
+  }
+
 private:
+  /* At most once response cache, one entry per tid: the seqs of the last
+   * request and of its response. A duplicate request pkt is answered by
+   * resending the response pkts, which are still in the retransmission
+   * queue, instead of running the request again. An entry is evicted once
+   * the peer's cumulative ack covers its response. */
+  struct cached_response {
+    uint64_t request_first = 0, request_last = 0;
+    uint64_t response_first = 0, response_last = 0;
+    /* the last response pkt was sent */
+    bool complete = false;
+  };
+
+  void note_request(uint16_t tid, uint64_t seq) {
+    if (tid >= responses.size())
+      return;
+    auto &entry = responses[tid];
+    /* the peer only reuses a tid once it got the response */
+    if (entry.complete && seq > entry.request_last) {
+      entry = cached_response{};
+      entry.request_first = seq;
+    }
+    if (!entry.request_first || seq < entry.request_first)
+      entry.request_first = seq;
+    entry.request_last = std::max(entry.request_last, seq);
+  }
+
+  void note_response(uint16_t tid, uint64_t seq, bool fini) {
+    if (tid >= responses.size())
+      return;
+    auto &entry = responses[tid];
+    if (!entry.response_first || entry.complete)
+      entry.response_first = seq;
+    entry.response_last = seq;
+    entry.complete = fini;
+  }
+
+  void replay_response(uint16_t tid, uint64_t seq) {
+    if (tid >= responses.size())
+      return;
+    auto &entry = responses[tid];
+    if (!entry.complete || seq < entry.request_first ||
+        seq > entry.request_last)
+      return;
+    if (entry.response_last < rt_handler.get_least_unacked()) {
+      /* acked, the duplicate is older than the response */
+      entry.complete = false;
+      entry.request_first = entry.request_last = 0;
+      return;
+    }
+    stats.replayed += rt_handler.retransmit_range(
+        entry.response_first, entry.response_last,
+        [&](message *msg) { pkt_if->consume_for_retransmission(msg); });
+  }
+
+  void transmit(message *msg) {
+    if (hdr_template.valid)
+      pkt_if->consume_pkt(msg, hdr_template);
+    else
+      pkt_if->consume_pkt(msg, sport, target);
+  }
+
   void setup_after_init() {
     recv_wd.advance([](message *msg) { rte_pktmbuf_free(msg); });
   }
   window<kOustandingMessages> recv_wd;
+  header_template hdr_template;
   con_config target;
   retransmission_handler rt_handler;
   ack_scheduler scheduler;
@@ -250,5 +467,11 @@ private:
   packet_if *pkt_if;
   uint16_t sport;
   uint32_t grant_returned = 0;
+  uint16_t grant_limit = kMaxGrant;
+  uint16_t push_tids = 0;
+  std::array<cached_response, kOustandingMessages> responses{};
   connection_state cstate = connection_state::ESTABLISHING;
 };
+
+using client_transport = basic_transport<client_policy>;
+using server_transport = basic_transport<server_policy>;
@@ -3,49 +3,70 @@
 #include "debug.h"
 #include "message.h"
 #include "protocol.h"
+#include "restart.h"
 #include "util.h"
+#include "bitmap.h"
 
+#include <algorithm>
 #include <array>
-#include <bitset>
+#include <bit>
 #include <cstdint>
 #include <cstring>
 #include <generic/rte_cycles.h>
 
 template <uint32_t N> struct window {
+  static_assert(N % bitmap::kWordBits == 0 && std::has_single_bit(N), "");
+  static constexpr uint32_t kWords = N / bitmap::kWordBits;
+
   window(uint64_t min_seq)
       : wd(), front(0), mask(N - 1), least_in_window(min_seq), max_rx(0) {}
 
   uint64_t get_last_acked_packet() const { return least_in_window - 1; }
 
   bool set(uint64_t seq, message *msg) {
+    if (beyond_window(seq))
+      return false;
     auto i = index(seq);
-    if (beyond_window(seq) || wd[i])
+    auto [w, b] = get_bit_indices_64(i);
+    if (wd[w] & (1ull << b))
       return false;
     if (seq > max_rx) {
       max_rx = seq;
       ts = *msg->get_ts();
     }
-    wd[i] = true;
+    wd[w] |= 1ull << b;
     messages[i] = msg;
     return true;
   }
 
   bool is_set(uint64_t seq) {
-    return seq < least_in_window ||
-           (seq <= least_in_window + mask && wd[index(seq)]);
+    if (seq < least_in_window)
+      return true;
+    if (seq > least_in_window + mask)
+      return false;
+    auto [w, b] = get_bit_indices_64(index(seq));
+    return wd[w] & (1ull << b);
   }
 
   bool beyond_window(uint64_t seq) { return seq > least_in_window + mask; }
 
+  /* hands out the run of ready messages at the front, a word at a time */
   template <typename F> uint32_t advance(F &&f) {
-    assert(mask + 1 == wd.size());
     uint32_t advanced = 0;
-    while (wd[front]) {
-      ++least_in_window;
-      f(messages[front]);
-      wd[front] = false;
-      front = (front + 1) & mask;
-      ++advanced;
+    while (true) {
+      auto [w, b] = get_bit_indices_64(front);
+      auto run = static_cast<uint32_t>(std::countr_one(wd[w] >> b));
+      run = std::min(run, bitmap::kWordBits - b);
+      if (run == 0)
+        break;
+      wd[w] &= ~(bitmap::valid_mask(0, run) << b);
+      least_in_window += run;
+      for (uint32_t k = 0; k < run; ++k)
+        f(messages[front + k]);
+      front = (front + run) & mask;
+      advanced += run;
+      if (b + run < bitmap::kWordBits)
+        break;
     }
     return advanced;
   }
@@ -69,18 +90,21 @@ template <uint32_t N> struct window {
 
   bool has_holes() { return max_rx != least_in_window - 1; }
 
+  /* bitmap of [least_in_window, max_rx] with least_in_window as bit 0 */
+  uint32_t copy_words(uint64_t *out) {
+    uint32_t len = max_rx - least_in_window + 1;
+    bitmap::rotated_copy(wd.data(), kWords, front, len, out);
+    return len;
+  }
+
   uint16_t copy_bitset(protocol::ft_sack_payload *data) {
-    uint16_t id = 0;
-    std::memset(data, 0,
-                (max_rx - least_in_window + 64) /
-                    64); /* 64 since least_in_window is part of the window */
-    for (auto i = least_in_window; i <= max_rx; ++i, ++id) {
-      auto ind = get_bit_indices_64(id);
-      data->bit_map[ind.first] |= static_cast<uint64_t>(wd[index(i)])
-                                  << ind.second;
-    }
-    data->bit_map_len = id;
-    return id;
+    static_assert(N <= protocol::ft_sack_payload::kBitMapLen * 64, "");
+    uint64_t words[kWords];
+    auto len = copy_words(words);
+    std::memcpy(data->bit_map, words,
+                bitmap::words_for(len) * sizeof(uint64_t));
+    data->bit_map_len = len;
+    return len;
   }
 
   std::size_t last_seq() const { return least_in_window + mask + 1; }
@@ -90,7 +114,48 @@ template <uint32_t N> struct window {
     return now - ts;
   }
 
-  std::bitset<N> wd;
+  /* the pkts held, with their ft header, for a hot restart */
+  void save(restart::writer &w) {
+    w.put(least_in_window);
+    w.put(max_rx);
+    w.put(ts);
+    uint32_t held = 0;
+    for (auto s = least_in_window; s <= max_rx; ++s)
+      held += is_set(s);
+    w.put(held);
+    for (auto s = least_in_window; s <= max_rx; ++s) {
+      if (is_set(s)) {
+        w.put(s);
+        w.put_msg(messages[index(s)], 0);
+      }
+    }
+  }
+
+  /* counterpart of save on an empty window */
+  bool restore(restart::reader &r, message_allocator *allocator) {
+    uint64_t least, max, last_ts;
+    uint32_t held;
+    if (!r.get(least) || !r.get(max) || !r.get(last_ts) || !r.get(held))
+      return false;
+    front = 0;
+    least_in_window = least;
+    max_rx = least - 1;
+    for (uint32_t i = 0; i < held; ++i) {
+      uint64_t s;
+      if (!r.get(s))
+        return false;
+      auto *msg = r.get_msg(allocator);
+      if (!msg)
+        return false;
+      if (!set(s, msg))
+        rte_pktmbuf_free(msg);
+    }
+    max_rx = max;
+    ts = last_ts;
+    return true;
+  }
+
+  std::array<uint64_t, kWords> wd;
   std::array<message *, N> messages{};
   std::size_t front, mask;
   uint64_t least_in_window;
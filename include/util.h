@@ -117,6 +117,10 @@ template <> inline uint32_t calc_hash<uint32_t>(const uint32_t &val) {
   return jhash_3words(val, 0, 0);
 }
 
+template <> inline uint32_t calc_hash<uint64_t>(const uint64_t &val) {
+  return jhash_3words(val, val >> 32, 0);
+}
+
 template <typename K, typename V> struct fixed_size_hash_table {
   using hash_t = uint32_t;
   struct entry_t {
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "connection.h"
+#include "kv.h"
+#include "message.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+/* Watched keys of one server lcore. changed queues a kv_notification for
+ * every connection watching the key, flush sends each connection its queue
+ * as kv_batch pushes of up to kMaxPerPush notifications, so a client hears
+ * of many changes in one pkt instead of polling every key. The connections
+ * must stay on this lcore, see basic_connection_manager::migrate. */
+class watch_table {
+  static constexpr uint32_t kMaxPerPush = 64;
+
+public:
+  struct statistics {
+    uint64_t notifications = 0;
+    uint64_t pushes = 0;
+  };
+
+  explicit watch_table(message_allocator *allocator) : allocator(allocator) {}
+
+  void watch(server_connection *con, int64_t key) {
+    auto &cons = watchers[key];
+    if (std::find(cons.begin(), cons.end(), con) == cons.end())
+      cons.push_back(con);
+  }
+
+  void unwatch(server_connection *con, int64_t key) {
+    auto it = watchers.find(key);
+    if (it == watchers.end())
+      return;
+    std::erase(it->second, con);
+    if (it->second.empty())
+      watchers.erase(it);
+  }
+
+  /* op is PUT or DELETE */
+  void changed(request_t op, int64_t key, int64_t val) {
+    auto it = watchers.find(key);
+    if (it == watchers.end())
+      return;
+    for (auto *con : it->second) {
+      auto &q = queued[con];
+      if (q.empty())
+        dirty.push_back(con);
+      q.push_back({op, key, val});
+      ++stats.notifications;
+    }
+  }
+
+  /* Pushes what changed since the last flush. Notifications a connection
+   * cannot take now, its window is full or it has no push tids, stay
+   * queued for the next flush. Returns the number of pushes sent. */
+  uint32_t flush() {
+    uint32_t sent = 0;
+    std::erase_if(dirty, [&](server_connection *con) {
+      auto &q = queued[con];
+      std::size_t done = 0;
+      while (done < q.size()) {
+        auto n = std::min<std::size_t>(q.size() - done, kMaxPerPush);
+        auto *msg = allocator->alloc_message(
+            sizeof(kv_batch<kv_notification>) + n * sizeof(kv_notification));
+        if (!msg)
+          break;
+        auto *batch = static_cast<kv_batch<kv_notification> *>(msg->data());
+        batch->pt = packet_t::BATCH;
+        batch->id = 0;
+        batch->elems = n;
+        std::memcpy(batch->elements, q.data() + done,
+                    n * sizeof(kv_notification));
+        if (!con->push(msg)) {
+          message_allocator::deallocate(msg);
+          break;
+        }
+        done += n;
+        ++sent;
+      }
+      q.erase(q.begin(), q.begin() + done);
+      return q.empty();
+    });
+    stats.pushes += sent;
+    return sent;
+  }
+
+  const statistics &get_stats() const { return stats; }
+
+private:
+  message_allocator *allocator;
+  std::unordered_map<int64_t, std::vector<server_connection *>> watchers;
+  std::unordered_map<server_connection *, std::vector<kv_notification>> queued;
+  /* connections with queued notifications */
+  std::vector<server_connection *> dirty;
+  statistics stats;
+};
@@ -1,28 +1,54 @@
 #include "connection.h"
 #include "iface.h"
+#include "kernel_dev.h"
 #include "kv.h"
 #include "message.h"
+#include "numa.h"
+#include "rpc.h"
 #include "server.h"
+#include "server_runtime.h"
+#include "shm_dev.h"
 #include "transport/slot.h"
+#include <algorithm>
 #include <arpa/inet.h>
 #include <bits/getopt_core.h>
+#include <csignal>
+#include <functional>
 #include <cstdint>
 #include <getopt.h>
+#include <iostream>
 #include <memory>
 #include <random>
 #include <ranges>
+#include <string_view>
 #include <rte_ether.h>
+#include <rte_lcore.h>
 #include <rte_log.h>
 #include <rte_mbuf.h>
 #include <rte_mbuf_core.h>
 #include <rte_mempool.h>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 struct netconfig {
   rte_ether_addr dmac;
   uint32_t sip, dip;
   uint16_t sport, dport;
+  bool kernel = false;
+  bool shm = false;
+  uint16_t workers = 0;
+  /* bit per request_t served on the workers */
+  uint8_t dispatched_ops = 0;
+  bool migrate = false;
+  server_connection_manager::poll_limits limits;
+  /* p99 queueing delay target, 0 disables overload control */
+  uint64_t slo_us = 0;
+  bool fast_path = false;
+  /* take over the connections of a process stopped with SIGUSR2 */
+  bool restore = false;
+  /* read lease granted with every GET, see lease_cache */
+  uint32_t lease_us = 0;
 };
 
 static std::random_device dev;
@@ -32,6 +58,28 @@ static std::uniform_int_distribution<std::mt19937::result_type> dist(INT64_MIN,
 static constexpr uint32_t kStoreSize = 1024;
 static std::unordered_map<int64_t, int64_t> store(kStoreSize);
 
+/* read only copy of the store per socket, lookups stay on the local one */
+using kv_replica =
+    std::unordered_map<int64_t, int64_t, std::hash<int64_t>,
+                       std::equal_to<int64_t>,
+                       numa::allocator<std::pair<const int64_t, int64_t>>>;
+static std::vector<std::unique_ptr<kv_replica>> replicas;
+
+static void replicate() {
+  unsigned lcore;
+  RTE_LCORE_FOREACH(lcore) {
+    auto socket = rte_lcore_to_socket_id(lcore);
+    if (socket >= replicas.size())
+      replicas.resize(socket + 1);
+    if (replicas[socket])
+      continue;
+    replicas[socket] = std::make_unique<kv_replica>(
+        store.begin(), store.end(), store.bucket_count(),
+        std::hash<int64_t>(), std::equal_to<int64_t>(),
+        numa::allocator<std::pair<const int64_t, int64_t>>(socket));
+  }
+}
+
 static void prepare() {
   for (auto [k, v] :
        std::ranges::views::iota(0, 1000) | std::views::transform([&](int) {
@@ -41,67 +89,228 @@ static void prepare() {
   }
 }
 
-static message *serve(message_allocator *allocator,
-                      kv_packet<kv_request> *packet) {
-  auto key = packet->payload.key;
-  auto it = store.find(key);
-
-  message *msg = allocator->alloc_message(sizeof(kv_packet<kv_completion>));
-  auto *completion = rte_pktmbuf_mtod(msg, kv_packet<kv_completion> *);
-  completion->id = packet->id;
-  completion->pt = packet->pt;
-  if (it == store.end()) {
-    completion->payload.reponse = response_t::FAILURE;
-    completion->payload.val = 0;
-  } else {
-    completion->payload.reponse = response_t::SUCCESS;
-    completion->payload.val = it->second;
+struct kv_service;
+
+/* the replicas never change, so any lease granted stays valid */
+static void get(const kv_service &service, const kv_rpc::request &req,
+                kv_rpc::response &resp);
+
+using kv_dispatcher = rpc::dispatcher<kv_rpc, const kv_service,
+                                      rpc::method<request_t::GET, &get>>;
+
+/* GETs are cheap lookups, but the request type decides where a request runs
+ * so slow operations can be moved off the I/O lcores */
+struct kv_service {
+  uint8_t dispatched_ops;
+  uint32_t lease_us;
+
+  /* short requests are answered by serve, right where they came in */
+  bool dispatch(message *msg) const {
+    rpc::view<const kv_rpc::request> req(msg);
+    if (!req.fits())
+      return false;
+    return dispatched_ops & (1u << static_cast<uint8_t>(kv_rpc::op(*req)));
+  }
+
+  message *serve(message *msg, message_allocator *allocator) const {
+    return kv_dispatcher::serve(*this, msg, allocator);
+  }
+
+  bool idempotent(message *msg) const {
+    rpc::view<const kv_rpc::request> req(msg);
+    return req.fits() && kv_rpc::op(*req) == request_t::GET;
+  }
+
+  /* nullptr for short requests or if no message could be allocated */
+  message *reject(message *msg, message_allocator *allocator) const {
+    rpc::view<const kv_rpc::request> req(msg);
+    if (!req.fits())
+      return nullptr;
+    auto *resp = allocator->alloc_message(sizeof(kv_rpc::response));
+    if (!resp)
+      return nullptr;
+    kv_rpc::reply(*req, *rpc::view<kv_rpc::response>(resp), response_t::BUSY);
+    return resp;
+  }
+};
+
+static void get(const kv_service &service, const kv_rpc::request &req,
+                kv_rpc::response &resp) {
+  auto &local = *replicas[rte_socket_id()];
+  auto it = local.find(req.payload.key);
+  if (it == local.end()) {
+    kv_rpc::reply(req, resp, response_t::FAILURE);
+    return;
   }
-  return msg;
+  kv_rpc::reply(req, resp, response_t::SUCCESS, it->second);
+  resp.payload.lease_us = service.lease_us;
+}
+
+static uint8_t parse_op(std::string_view op) {
+  if (op == "get")
+    return 1u << static_cast<uint8_t>(request_t::GET);
+  if (op == "put")
+    return 1u << static_cast<uint8_t>(request_t::PUT);
+  if (op == "delete")
+    return 1u << static_cast<uint8_t>(request_t::DELETE);
+  return 0;
 }
 
 static netconfig parse_cmdline(int argc, char *argv[]) {
   int opt, option_index;
   netconfig conf;
-  static const struct option long_options[] = {{"sip", required_argument, 0, 0},
-                                               {0, 0, 0, 0}};
+  static const struct option long_options[] = {
+      {"sip", required_argument, 0, 0},
+      {"sport", required_argument, 0, 0},
+      {"backend", required_argument, 0, 0},
+      {"shm", no_argument, 0, 0},
+      {"workers", required_argument, 0, 0},
+      {"dispatch", required_argument, 0, 0},
+      {"migrate", no_argument, 0, 0},
+      {"poll-budget", required_argument, 0, 0},
+      {"poll-per-connection", required_argument, 0, 0},
+      {"slo-us", required_argument, 0, 0},
+      {"fast-path", no_argument, 0, 0},
+      {"restore", no_argument, 0, 0},
+      {"lease-us", required_argument, 0, 0},
+      {0, 0, 0, 0}};
   while ((opt = getopt_long(argc, argv, "", long_options, &option_index)) !=
          -1) {
     switch (option_index) {
     case 0:
       conf.sip = inet_addr(optarg);
       break;
+    case 1:
+      conf.sport = atoi(optarg);
+      break;
+    case 2:
+      conf.kernel = std::string_view(optarg) == "kernel";
+      break;
+    case 3:
+      conf.shm = true;
+      break;
+    case 4:
+      conf.workers = atoi(optarg);
+      break;
+    case 5:
+      conf.dispatched_ops |= parse_op(optarg);
+      break;
+    case 6:
+      conf.migrate = true;
+      break;
+    case 7:
+      conf.limits.budget = atoi(optarg);
+      break;
+    case 8:
+      conf.limits.per_connection = atoi(optarg);
+      break;
+    case 9:
+      conf.slo_us = atoi(optarg);
+      break;
+    case 10:
+      conf.fast_path = true;
+      break;
+    case 11:
+      conf.restore = true;
+      break;
+    case 12:
+      conf.lease_us = atoi(optarg);
+      break;
     }
   }
   return conf;
 }
 
+static server_runtime *runtime = nullptr;
+
+static void handle_signal(int) {
+  if (runtime)
+    runtime->stop();
+}
+
+static void handle_hand_over(int) {
+  if (runtime)
+    runtime->hand_over();
+}
+
 int run(netconfig &conf) {
   prepare();
   rte_log_set_global_level(RTE_LOG_DEBUG);
   if (fastt::init())
     return -1;
-  auto ifc = iface::configure_port(0, 1, 1);
-  if (!ifc)
-    return -1;
-  auto [port, txq, rxq, pool] = ifc->get_slice(0);
-  std::shared_ptr<message_allocator> allocator =
-      std::make_shared<message_allocator>("pool", 8095);
-  server_iface server(port, txq, rxq, con_config{conf.sip, conf.sport},
-                      allocator);
-  while (true) {
-    server.poll([&](transaction_slot &slot) {
-      auto *msg = slot.rx_if.read();
-      auto *resp = serve(allocator.get(),
-                         rte_pktmbuf_mtod(msg, kv_packet<kv_request> *));
-      slot.tx_if.send(resp, true);
-      if (!slot.has_outstanding_messages())
-        slot.finish();
-      message_allocator::deallocate(msg);
-    });
-    server.complete();
+  auto cnt = rte_lcore_count();
+  std::unique_ptr<iface> ifc;
+  conf.workers = std::min<uint16_t>(conf.workers, cnt - 1);
+  cnt -= conf.workers;
+  if (!conf.kernel) {
+    ifc = iface::configure_port(0, cnt, cnt);
+    if (!ifc)
+      return -1;
   }
-  return 0;
+  replicate();
+  server_runtime rt(
+      con_config{conf.sip, conf.sport},
+      [&](uint16_t queue,
+          message_allocator *allocator) -> std::unique_ptr<dev_backend> {
+        std::unique_ptr<dev_backend> backend;
+        if (conf.kernel) {
+          backend = udp_socket_backend::create(conf.sip, conf.sport,
+                                               allocator->mempool());
+        } else {
+          auto [port, txq, rxq, pool] = ifc->get_slice(queue);
+          backend = std::make_unique<dpdk_backend>(port, txq, rxq);
+        }
+        /* the region is named after the address, only one lcore owns it */
+        if (backend && conf.shm && queue == 0)
+          backend = shm_backend::create(std::move(backend), conf.sip,
+                                        conf.sport, allocator->mempool());
+        return backend;
+      },
+      conf.workers);
+  if (conf.migrate)
+    rt.enable_migration({});
+  rt.set_poll_limits(conf.limits);
+  rt.enable_fast_path(conf.fast_path);
+  rt.take_over(conf.restore);
+  if (conf.slo_us) {
+    overload_control::config overload;
+    overload.slo_us = conf.slo_us;
+    rt.enable_overload_control(overload);
+  }
+  runtime = &rt;
+  std::signal(SIGINT, handle_signal);
+  std::signal(SIGTERM, handle_signal);
+  std::signal(SIGUSR2, handle_hand_over);
+  auto retval =
+      rt.run_dispatched(kv_service{conf.dispatched_ops, conf.lease_us});
+  runtime = nullptr;
+  if (ifc)
+    ifc->stop();
+
+  uint64_t total = 0;
+  auto &stats = rt.get_stats();
+  if (conf.restore) {
+    uint64_t blackout = 0;
+    for (std::size_t i = 0; i < rt.io_lcores(); ++i) {
+      blackout = std::max(blackout, stats[i].blackout_us.load());
+      std::cout << "lcore " << i << ": took over "
+                << stats[i].restored.load() << " connections after "
+                << stats[i].blackout_us.load() << " us" << std::endl;
+    }
+    std::cout << "blackout: " << blackout << " us" << std::endl;
+  }
+  for (std::size_t i = 0; i < rt.io_lcores(); ++i) {
+    auto requests = stats[i].requests.load();
+    total += requests;
+    std::cout << "lcore " << i << ": " << requests / rt.seconds() << " req/s, "
+              << stats[i].dispatched.load() << " dispatched, "
+              << stats[i].migrated.load() << " connections migrated away, "
+              << stats[i].rejected.load() << " rejected" << std::endl;
+  }
+  std::cout << "total: " << total / rt.seconds() << " req/s" << std::endl;
+  /* DPDK heap, gone after rte_eal_cleanup */
+  replicas.clear();
+  return retval;
 }
 
 int main(int argc, char *argv[]) {
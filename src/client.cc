@@ -3,8 +3,8 @@
 #include "transaction.h"
 #include "util.h"
 
-connection *client_iface::open_connection(const con_config &target,
-                                          rte_ether_addr &dmac) {
+client_connection *client_iface::open_connection(const con_config &target,
+                                          rte_ether_addr &dmac, bool flush) {
   manager.add_mac(target.ip, dmac);
-  return manager.open_connection(scon_config, target);
+  return manager.open_connection(scon_config, target, flush);
 }
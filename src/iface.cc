@@ -6,6 +6,7 @@
 #include <memory>
 #include <rte_ethdev.h>
 #include <rte_lcore.h>
+#include <rte_log.h>
 #include <rte_mbuf.h>
 #include <rte_mbuf_core.h>
 #include <rte_mempool.h>
@@ -52,6 +53,17 @@ static inline int setup_reta(uint16_t port, uint32_t nrx, uint32_t reta_size){
     return 0;
 }
 
+/* pkts of a NIC on another socket cross the interconnect on every rx and tx */
+static void warn_remote(uint16_t port, unsigned lcore_id) {
+  auto port_socket = rte_eth_dev_socket_id(port);
+  if (port_socket == SOCKET_ID_ANY ||
+      port_socket == static_cast<int>(rte_lcore_to_socket_id(lcore_id)))
+    return;
+  RTE_LOG(WARNING, USER1,
+          "lcore %u on socket %u polls port %u on remote socket %d\n",
+          lcore_id, rte_lcore_to_socket_id(lcore_id), port, port_socket);
+}
+
 std::unique_ptr<iface> iface::configure_port(uint16_t port_id, uint16_t ntx,
                                            uint16_t nrx) {
   uint16_t nb_rxd, nb_txd;
@@ -70,8 +82,10 @@ std::unique_ptr<iface> iface::configure_port(uint16_t port_id, uint16_t ntx,
   nb_rxd = dev_info.rx_desc_lim.nb_max;
   nb_txd = dev_info.tx_desc_lim.nb_max;
 
-  if (dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_MBUF_FAST_FREE)
-    port_conf.txmode.offloads |= RTE_ETH_TX_OFFLOAD_MBUF_FAST_FREE;
+  /* no MBUF_FAST_FREE, retransmitted pkts have refcnt > 1 and payloads sent
+   * from application buffers are chained external mbufs */
+  if (dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_MULTI_SEGS)
+    port_conf.txmode.offloads |= RTE_ETH_TX_OFFLOAD_MULTI_SEGS;
   if (dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_IPV4_CKSUM)
     port_conf.txmode.offloads |= RTE_ETH_TX_OFFLOAD_IPV4_CKSUM;
   if (dev_info.tx_offload_capa & RTE_ETH_TX_OFFLOAD_UDP_CKSUM)
@@ -115,18 +129,24 @@ std::unique_ptr<iface> iface::configure_port(uint16_t port_id, uint16_t ntx,
   uint16_t lcore_id = 0;
   uint16_t setup_tx = 0;
   uint16_t setup_rx = 0;
+  /* queue i is polled by the i-th lcore, its descriptors and rx pool live on
+   * that lcore's socket */
   RTE_LCORE_FOREACH(lcore_id) {
-    ifc->pools.emplace_back(
-        rte_pktmbuf_pool_create(std::to_string(lcore_id).data(), 2 * nb_rxd,
-                                256, 0, RTE_MBUF_DEFAULT_BUF_SIZE,
-                                rte_lcore_to_socket_id(lcore_id)),
-        deleter);
-    if (rte_eth_rx_queue_setup(ifc->port, setup_rx++, nb_rxd,
-                               rte_lcore_to_socket_id(lcore_id), &rxconf,
-                               ifc->pools.back().get()))
-      return nullptr;
-    if (rte_eth_tx_queue_setup(ifc->port, setup_tx++, nb_txd,
-                               rte_lcore_to_socket_id(lcore_id), &txconf))
+    if (setup_rx == nrx && setup_tx == ntx)
+      break;
+    auto socket = rte_lcore_to_socket_id(lcore_id);
+    warn_remote(ifc->port, lcore_id);
+    if (setup_rx < nrx) {
+      ifc->pools.emplace_back(
+          rte_pktmbuf_pool_create(std::to_string(lcore_id).data(), 2 * nb_rxd,
+                                  256, 0, RTE_MBUF_DEFAULT_BUF_SIZE, socket),
+          deleter);
+      if (rte_eth_rx_queue_setup(ifc->port, setup_rx++, nb_rxd, socket,
+                                 &rxconf, ifc->pools.back().get()))
+        return nullptr;
+    }
+    if (setup_tx < ntx &&
+        rte_eth_tx_queue_setup(ifc->port, setup_tx++, nb_txd, socket, &txconf))
       return nullptr;
   }
   ifc->tx_queues = setup_tx;
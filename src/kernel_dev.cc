@@ -0,0 +1,293 @@
+#include "kernel_dev.h"
+#include "debug.h"
+#include "protocol.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <rte_byteorder.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_mbuf.h>
+#include <rte_udp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static constexpr int kSocketBufferSize = 4 << 20;
+
+std::unique_ptr<dev_backend>
+udp_socket_backend::create(uint32_t ip, uint16_t port, rte_mempool *pool) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0)
+    return nullptr;
+  /* one socket per lcore on the same port, the kernel spreads the flows */
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+  int size = kSocketBufferSize;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = ip;
+  addr.sin_port = rte_cpu_to_be_16(port);
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))) {
+    FASTT_LOG_DEBUG("Binding udp socket failed: %s\n", strerror(errno));
+    close(fd);
+    return nullptr;
+  }
+#ifdef FASTT_HAVE_LIBURING
+  if (auto backend = uring_backend::create(fd, ip, port, pool))
+    return backend;
+  FASTT_LOG_DEBUG("io_uring unavailable, falling back to recvmmsg/sendmmsg\n");
+#endif
+  return std::make_unique<mmsg_backend>(fd, ip, port, pool);
+}
+
+udp_socket_backend::~udp_socket_backend() { close(fd); }
+
+uint16_t udp_socket_backend::prepare_tx(rte_mbuf *pkt, iovec *iov,
+                                        sockaddr_in &addr) {
+  auto *ipv4 = rte_pktmbuf_mtod_offset(pkt, rte_ipv4_hdr *,
+                                       protocol::defs::kipOffset);
+  auto *udp =
+      rte_pktmbuf_mtod_offset(pkt, rte_udp_hdr *, protocol::defs::kudpOffset);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = ipv4->dst_addr;
+  addr.sin_port = udp->dst_port;
+  assert(pkt->nb_segs <= kMaxSegs);
+  iov[0].iov_base =
+      rte_pktmbuf_mtod_offset(pkt, void *, protocol::defs::kftOffset);
+  iov[0].iov_len = pkt->data_len - protocol::defs::kftOffset;
+  uint16_t n = 1;
+  for (auto *seg = pkt->next; seg; seg = seg->next, ++n) {
+    iov[n].iov_base = rte_pktmbuf_mtod(seg, void *);
+    iov[n].iov_len = seg->data_len;
+  }
+  return n;
+}
+
+bool udp_socket_backend::prepare_rx(rte_mbuf *pkt, iovec &iov) {
+  if (rte_pktmbuf_tailroom(pkt) <= protocol::defs::kftOffset)
+    return false;
+  iov.iov_base = rte_pktmbuf_mtod_offset(pkt, void *, protocol::defs::kftOffset);
+  iov.iov_len = rte_pktmbuf_tailroom(pkt) - protocol::defs::kftOffset;
+  return true;
+}
+
+void udp_socket_backend::finish_rx(rte_mbuf *pkt, uint32_t len,
+                                   const sockaddr_in &addr) {
+  pkt->data_len = protocol::defs::kftOffset + len;
+  pkt->pkt_len = pkt->data_len;
+  pkt->ol_flags = 0;
+  auto *eth = rte_pktmbuf_mtod(pkt, rte_ether_hdr *);
+  std::memset(eth, 0, sizeof(rte_ether_hdr));
+  eth->dst_addr = kMac;
+  eth->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+  auto *ipv4 = rte_pktmbuf_mtod_offset(pkt, rte_ipv4_hdr *,
+                                       protocol::defs::kipOffset);
+  std::memset(ipv4, 0, sizeof(rte_ipv4_hdr));
+  ipv4->version_ihl = RTE_IPV4_VHL_DEF;
+  ipv4->next_proto_id = IPPROTO_UDP;
+  ipv4->total_length =
+      rte_cpu_to_be_16(pkt->pkt_len - protocol::defs::kipOffset);
+  ipv4->src_addr = addr.sin_addr.s_addr;
+  ipv4->dst_addr = ip;
+  auto *udp =
+      rte_pktmbuf_mtod_offset(pkt, rte_udp_hdr *, protocol::defs::kudpOffset);
+  udp->src_port = addr.sin_port;
+  udp->dst_port = rte_cpu_to_be_16(port);
+  udp->dgram_len = rte_cpu_to_be_16(len + sizeof(rte_udp_hdr));
+  udp->dgram_cksum = 0;
+}
+
+mmsg_backend::mmsg_backend(int fd, uint32_t ip, uint16_t port,
+                           rte_mempool *pool)
+    : udp_socket_backend(fd, ip, port, pool) {
+  for (uint16_t i = 0; i < kBurstSize; ++i) {
+    tx_msgs[i].msg_hdr.msg_name = &tx_addrs[i];
+    tx_msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    tx_msgs[i].msg_hdr.msg_iov = tx_iovs[i].data();
+    rx_msgs[i].msg_hdr.msg_iov = &rx_iovs[i];
+    rx_msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+}
+
+mmsg_backend::~mmsg_backend() {
+  for (auto *pkt : rx_pkts)
+    if (pkt)
+      rte_pktmbuf_free(pkt);
+}
+
+bool mmsg_backend::refill() {
+  if (rx_missing == 0)
+    return true;
+  if (rte_pktmbuf_alloc_bulk(pool, rx_pkts.data(), rx_missing))
+    return false;
+  for (uint16_t i = 0; i < rx_missing; ++i)
+    prepare_rx(rx_pkts[i], rx_iovs[i]);
+  rx_missing = 0;
+  return true;
+}
+
+uint16_t mmsg_backend::tx_burst(rte_mbuf **pkts, uint16_t cnt) {
+  auto n = std::min(cnt, kBurstSize);
+  for (uint16_t i = 0; i < n; ++i)
+    tx_msgs[i].msg_hdr.msg_iovlen =
+        prepare_tx(pkts[i], tx_iovs[i].data(), tx_addrs[i]);
+  int sent = sendmmsg(fd, tx_msgs.data(), n, MSG_DONTWAIT);
+  if (sent < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+      return 0;
+    /* drop the burst, the transport retransmits */
+    FASTT_LOG_DEBUG("sendmmsg failed: %s\n", strerror(errno));
+    sent = n;
+  }
+  rte_pktmbuf_free_bulk(pkts, sent);
+  return sent;
+}
+
+uint16_t mmsg_backend::rx_burst(rte_mbuf **pkts, uint16_t cnt) {
+  if (!refill())
+    return 0;
+  auto n = std::min(cnt, kBurstSize);
+  for (uint16_t i = 0; i < n; ++i) {
+    rx_msgs[i].msg_hdr.msg_name = &rx_addrs[i];
+    rx_msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+  }
+  int rcvd = recvmmsg(fd, rx_msgs.data(), n, MSG_DONTWAIT, nullptr);
+  if (rcvd <= 0)
+    return 0;
+  /* recvmmsg fills the front, refill() replaces exactly those buffers */
+  for (int i = 0; i < rcvd; ++i) {
+    finish_rx(rx_pkts[i], rx_msgs[i].msg_len, rx_addrs[i]);
+    pkts[i] = rx_pkts[i];
+    rx_pkts[i] = nullptr;
+  }
+  rx_missing = rcvd;
+  return rcvd;
+}
+
+#ifdef FASTT_HAVE_LIBURING
+std::unique_ptr<dev_backend> uring_backend::create(int fd, uint32_t ip,
+                                                   uint16_t port,
+                                                   rte_mempool *pool) {
+  std::unique_ptr<uring_backend> backend(
+      new uring_backend(fd, ip, port, pool));
+  /* let peeking for completions run pending task work, older kernels
+   * reject the flags */
+  if (io_uring_queue_init(kRingEntries, &backend->ring,
+                          IORING_SETUP_COOP_TASKRUN |
+                              IORING_SETUP_TASKRUN_FLAG) &&
+      io_uring_queue_init(kRingEntries, &backend->ring, 0)) {
+    /* the caller still owns fd */
+    backend->fd = -1;
+    return nullptr;
+  }
+  for (uint16_t i = 0; i < kTxSlots; ++i)
+    backend->tx_free_list[backend->tx_free++] = i;
+  for (uint16_t i = 0; i < kBurstSize; ++i)
+    if (!backend->post_recv(i))
+      backend->rx_idle[backend->rx_nidle++] = i;
+  io_uring_submit(&backend->ring);
+  return backend;
+}
+
+uring_backend::~uring_backend() {
+  if (fd < 0)
+    return;
+  io_uring_queue_exit(&ring);
+  for (auto &slot : rx_slots)
+    if (slot.pkt)
+      rte_pktmbuf_free(slot.pkt);
+  for (auto &slot : tx_slots)
+    if (slot.pkt)
+      rte_pktmbuf_free(slot.pkt);
+}
+
+bool uring_backend::post_recv(uint16_t idx) {
+  auto &slot = rx_slots[idx];
+  if (!slot.pkt) {
+    slot.pkt = rte_pktmbuf_alloc(pool);
+    if (!slot.pkt)
+      return false;
+    prepare_rx(slot.pkt, slot.iov[0]);
+  }
+  auto *sqe = io_uring_get_sqe(&ring);
+  if (!sqe)
+    return false;
+  slot.hdr = {};
+  slot.hdr.msg_name = &slot.addr;
+  slot.hdr.msg_namelen = sizeof(sockaddr_in);
+  slot.hdr.msg_iov = slot.iov;
+  slot.hdr.msg_iovlen = 1;
+  io_uring_prep_recvmsg(sqe, fd, &slot.hdr, 0);
+  io_uring_sqe_set_data64(sqe, static_cast<uint64_t>(idx) << 1);
+  return true;
+}
+
+void uring_backend::reap() {
+  io_uring_cqe *cqe;
+  while (io_uring_peek_cqe(&ring, &cqe) == 0) {
+    auto data = io_uring_cqe_get_data64(cqe);
+    auto idx = static_cast<uint16_t>(data >> 1);
+    if (data & kTxTag) {
+      auto &slot = tx_slots[idx];
+      rte_pktmbuf_free(slot.pkt);
+      slot.pkt = nullptr;
+      tx_free_list[tx_free++] = idx;
+    } else if (cqe->res > 0) {
+      finish_rx(rx_slots[idx].pkt, cqe->res, rx_slots[idx].addr);
+      rx_ready.enqueue(idx);
+    } else if (!post_recv(idx))
+      rx_idle[rx_nidle++] = idx;
+    io_uring_cqe_seen(&ring, cqe);
+  }
+}
+
+uint16_t uring_backend::tx_burst(rte_mbuf **pkts, uint16_t cnt) {
+  if (tx_free < cnt)
+    reap();
+  uint16_t n = 0;
+  for (; n < cnt && tx_free > 0; ++n) {
+    auto *sqe = io_uring_get_sqe(&ring);
+    if (!sqe)
+      break;
+    auto idx = tx_free_list[--tx_free];
+    auto &slot = tx_slots[idx];
+    slot.pkt = pkts[n];
+    slot.hdr = {};
+    slot.hdr.msg_iovlen = prepare_tx(slot.pkt, slot.iov, slot.addr);
+    slot.hdr.msg_name = &slot.addr;
+    slot.hdr.msg_namelen = sizeof(sockaddr_in);
+    slot.hdr.msg_iov = slot.iov;
+    io_uring_prep_sendmsg(sqe, fd, &slot.hdr, 0);
+    io_uring_sqe_set_data64(sqe, (static_cast<uint64_t>(idx) << 1) | kTxTag);
+  }
+  if (n)
+    io_uring_submit(&ring);
+  return n;
+}
+
+uint16_t uring_backend::rx_burst(rte_mbuf **pkts, uint16_t cnt) {
+  reap();
+  uint16_t n = 0;
+  for (; n < cnt && !rx_ready.empty(); ++n) {
+    auto idx = *rx_ready.front();
+    rx_ready.pop_front();
+    pkts[n] = rx_slots[idx].pkt;
+    rx_slots[idx].pkt = nullptr;
+    if (!post_recv(idx))
+      rx_idle[rx_nidle++] = idx;
+  }
+  for (auto i = rx_nidle; i > 0; --i) {
+    auto idx = rx_idle[i - 1];
+    if (!post_recv(idx))
+      break;
+    --rx_nidle;
+  }
+  io_uring_submit(&ring);
+  return n;
+}
+#endif
@@ -1,8 +1,9 @@
 #include "kv.h"
+#include "lease.h"
 #include "transaction.h"
 #include <rte_mbuf_core.h>
 
-std::unique_ptr<transaction_proxy> kv_proxy::start_transaction(connection *con,
+std::unique_ptr<transaction_proxy> kv_proxy::start_transaction(client_connection *con,
                                                            transaction_queue &q) {
   auto* slot = con->start_transaction();  
   if(!slot)
@@ -14,3 +15,14 @@ std::unique_ptr<transaction_proxy> kv_proxy::start_transaction(connection *con,
 void kv_proxy::finish_transaction(transaction_proxy* proxy){
     proxy->con->finish_transaction(proxy->t->slot);
 }
+
+bool kv_proxy::lookup_cached(int64_t key, int64_t& val){
+    return cache && cache->lookup(key, val);
+}
+
+void kv_proxy::complete_lookup(int64_t key, message* resp, uint64_t sent){
+    if(!cache)
+        return;
+    auto* completion = rte_pktmbuf_mtod(resp, kv_packet<kv_completion>*);
+    cache->fill(key, completion->payload, sent);
+}
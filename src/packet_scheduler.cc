@@ -1,4 +1,5 @@
 #include "packet_scheduler.h"
+#include <algorithm>
 #include <cstdint>
 #include <rte_cycles.h>
 
@@ -9,6 +10,18 @@ bool packet_scheduler::add_pkt(rte_mbuf *pkt) {
   return true;
 }
 
+void packet_scheduler::add_burst(rte_mbuf *const *pkts, uint16_t n) {
+  while (n) {
+    if (ptr == buffer.size())
+      do_send();
+    auto chunk = std::min<std::size_t>(n, buffer.size() - ptr);
+    std::copy_n(pkts, chunk, buffer.data() + ptr);
+    ptr += chunk;
+    pkts += chunk;
+    n -= chunk;
+  }
+}
+
 uint16_t packet_scheduler::flush() {  
   if(ptr == 0)
       return 0;
@@ -27,18 +27,19 @@ void protocol::prepare_ack_pkt(message* msg, uint64_t ack, uint16_t wnd, uint32_
 }
 
 
-void protocol::prepare_init_header(message* msg, uint64_t seq){
+void protocol::prepare_init_header(message* msg, uint64_t seq, uint16_t push_tids){
     auto *ft = static_cast<ft_header*>(msg->data());
     ft->seq = seq;
-    ft->msg_id = 0;
+    ft->msg_id = push_tids;
     ft->ts = 0;
     ft->sack = 0;
     ft->type = protocol::pkt_type::FT_INIT;
 }
 
 
-void protocol::prepare_init_ack_header(message* msg, uint64_t seq, uint64_t ack, uint16_t wnd){
+void protocol::prepare_init_ack_header(message* msg, uint64_t seq, uint64_t ack, uint16_t wnd, uint16_t push_tids){
     auto *ft = rte_pktmbuf_mtod(msg, protocol::ft_header*);
+    ft->msg_id = push_tids;
     ft->ack = ack;
     ft->wnd = wnd;
     ft->seq = seq;
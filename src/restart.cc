@@ -0,0 +1,124 @@
+#include "restart.h"
+#include "debug.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace restart {
+
+static constexpr std::size_t kHugePageSize = 2 << 20;
+static constexpr const char *kRegionDirs[] = {"/dev/hugepages", "/dev/shm"};
+
+static std::size_t mapped_size(std::size_t len) {
+  return (sizeof(region_header) + len + kHugePageSize - 1) &
+         ~(kHugePageSize - 1);
+}
+
+static std::string region_path(const char *dir, uint32_t ip, uint16_t port,
+                               uint16_t idx) {
+  char name[64];
+  snprintf(name, sizeof(name), "/fastt-restart-%08x-%u-%u", ip, port, idx);
+  return std::string(dir) + name;
+}
+
+uint64_t monotonic_ns() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+bool publish(uint32_t ip, uint16_t port, uint16_t idx, uint64_t stopped_ns,
+             const std::function<uint32_t(writer &)> &save) {
+  writer counter;
+  save(counter);
+  auto len = counter.size();
+  auto size = mapped_size(len);
+  for (auto *dir : kRegionDirs) {
+    auto path = region_path(dir, ip, port, idx);
+    unlink(path.c_str());
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+      continue;
+    if (ftruncate(fd, size)) {
+      close(fd);
+      unlink(path.c_str());
+      continue;
+    }
+    void *addr =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+      unlink(path.c_str());
+      continue;
+    }
+    auto *hdr = static_cast<region_header *>(addr);
+    writer w(hdr + 1, len);
+    hdr->connections = save(w);
+    hdr->stopped_ns = stopped_ns;
+    hdr->len = w.size();
+    bool ok = w.ok();
+    if (ok)
+      hdr->magic.store(region_header::kMagic, std::memory_order_release);
+    munmap(addr, size);
+    if (!ok) {
+      unlink(path.c_str());
+      return false;
+    }
+    return true;
+  }
+  FASTT_LOG_DEBUG("Publishing restart state failed: %s\n", strerror(errno));
+  return false;
+}
+
+std::optional<snapshot> snapshot::open(uint32_t ip, uint16_t port,
+                                       uint16_t idx) {
+  for (auto *dir : kRegionDirs) {
+    auto path = region_path(dir, ip, port, idx);
+    int fd = ::open(path.c_str(), O_RDWR);
+    if (fd < 0)
+      continue;
+    struct stat st;
+    if (fstat(fd, &st) ||
+        static_cast<std::size_t>(st.st_size) < sizeof(region_header)) {
+      close(fd);
+      continue;
+    }
+    std::size_t size = st.st_size;
+    void *addr =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+      continue;
+    auto *hdr = static_cast<region_header *>(addr);
+    if (hdr->magic.load(std::memory_order_acquire) != region_header::kMagic ||
+        sizeof(region_header) + hdr->len > size) {
+      munmap(addr, size);
+      unlink(path.c_str());
+      continue;
+    }
+    return snapshot(hdr, size, std::move(path));
+  }
+  return std::nullopt;
+}
+
+snapshot::snapshot(snapshot &&other) noexcept
+    : hdr(other.hdr), mapped(other.mapped), path(std::move(other.path)) {
+  other.hdr = nullptr;
+}
+
+snapshot::~snapshot() {
+  if (!hdr)
+    return;
+  munmap(hdr, mapped);
+  unlink(path.c_str());
+}
+
+reader snapshot::data() const { return reader(hdr + 1, hdr->len); }
+
+} // namespace restart
@@ -0,0 +1,315 @@
+#include "shm_dev.h"
+#include "debug.h"
+#include "protocol.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <rte_cycles.h>
+#include <rte_ip.h>
+#include <rte_mbuf.h>
+#include <rte_udp.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr std::size_t kHugePageSize = 2 << 20;
+static constexpr const char *kRegionDirs[] = {"/dev/hugepages", "/dev/shm"};
+
+static std::size_t region_size() {
+  return (sizeof(shm_region) + kHugePageSize - 1) & ~(kHugePageSize - 1);
+}
+
+static std::string region_path(const char *dir, uint32_t ip, uint16_t port) {
+  char name[64];
+  snprintf(name, sizeof(name), "/fastt-%08x-%u", ip, port);
+  return std::string(dir) + name;
+}
+
+static shm_region *map_region(uint32_t ip, uint16_t port, bool create) {
+  for (auto *dir : kRegionDirs) {
+    auto path = region_path(dir, ip, port);
+    if (create)
+      unlink(path.c_str());
+    int fd = open(path.c_str(), create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR,
+                  0600);
+    if (fd < 0)
+      continue;
+    if (create && ftruncate(fd, region_size())) {
+      close(fd);
+      unlink(path.c_str());
+      continue;
+    }
+    void *addr = mmap(nullptr, region_size(), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+      if (create)
+        unlink(path.c_str());
+      continue;
+    }
+    auto *region = static_cast<shm_region *>(addr);
+    if (!create &&
+        std::atomic_ref(region->magic).load(std::memory_order_acquire) !=
+            shm_region::kMagic) {
+      munmap(addr, region_size());
+      continue;
+    }
+    return region;
+  }
+  return nullptr;
+}
+
+static void unmap_region(shm_region *region) {
+  munmap(region, region_size());
+}
+
+static bool alive(pid_t pid) { return !kill(pid, 0) || errno == EPERM; }
+
+/* longest frame a fresh mbuf of pool holds, at most a ring slot */
+static uint32_t frame_room(rte_mempool *pool) {
+  return std::min<uint32_t>(shm_ring::kSlotSize,
+                            rte_pktmbuf_data_room_size(pool) -
+                                RTE_PKTMBUF_HEADROOM);
+}
+
+bool shm_ring::push(rte_mbuf *pkt) {
+  if (pkt->pkt_len > max_len)
+    return false;
+  auto t = tail.load(std::memory_order_relaxed);
+  if (t - head.load(std::memory_order_acquire) == kSlots)
+    return false;
+  auto &s = slots[t & (kSlots - 1)];
+  uint32_t off = 0;
+  for (auto *seg = pkt; seg; seg = seg->next) {
+    std::memcpy(s.data + off, rte_pktmbuf_mtod(seg, void *), seg->data_len);
+    off += seg->data_len;
+  }
+  s.len = off;
+  tail.store(t + 1, std::memory_order_release);
+  return true;
+}
+
+rte_mbuf *shm_ring::pop(rte_mempool *pool) {
+  auto h = head.load(std::memory_order_relaxed);
+  if (h == tail.load(std::memory_order_acquire))
+    return nullptr;
+  auto *pkt = rte_pktmbuf_alloc(pool);
+  if (!pkt)
+    return nullptr;
+  auto &s = slots[h & (kSlots - 1)];
+  auto *data = rte_pktmbuf_append(pkt, s.len);
+  if (data)
+    std::memcpy(data, s.data, s.len);
+  head.store(h + 1, std::memory_order_release);
+  if (data)
+    return pkt;
+  /* longer than max_len promised, dropped like a bad frame on the wire */
+  rte_pktmbuf_free(pkt);
+  return nullptr;
+}
+
+std::unique_ptr<dev_backend>
+shm_backend::create(std::unique_ptr<dev_backend> inner, uint32_t ip,
+                    uint16_t port, rte_mempool *pool) {
+  auto *region = map_region(ip, port, true);
+  if (!region) {
+    FASTT_LOG_DEBUG("Creating shm region failed: %s\n", strerror(errno));
+    return nullptr;
+  }
+  region->ip = ip;
+  region->port = port;
+  region->pid = getpid();
+  for (auto &channel : region->channels) {
+    channel.to_owner.max_len = frame_room(pool);
+    channel.state.store(shm_channel::FREE, std::memory_order_relaxed);
+  }
+  std::atomic_ref(region->magic).store(shm_region::kMagic,
+                                       std::memory_order_release);
+  return std::unique_ptr<dev_backend>(
+      new shm_backend(std::move(inner), ip, port, pool, region));
+}
+
+shm_backend::~shm_backend() {
+  std::atomic_ref(own->magic).store(0, std::memory_order_release);
+  for (uint16_t i = 0; i < nattached; ++i) {
+    attached[i]->channel->state.store(shm_channel::FREE,
+                                      std::memory_order_release);
+    unmap_region(attached[i]->region);
+  }
+  for (auto *dir : kRegionDirs)
+    unlink(region_path(dir, ip, port).c_str());
+  unmap_region(own);
+}
+
+void shm_backend::macaddr(rte_ether_addr *addr) {
+  if (inner)
+    inner->macaddr(addr);
+  else
+    *addr = {{0x02, 0, 0, 0, 0, 0x02}};
+}
+
+bool shm_backend::attach(peer &p, uint32_t dip, uint16_t dport) {
+  if (nattached == attached.size())
+    return false;
+  auto *region = map_region(dip, dport, false);
+  if (!region)
+    return false;
+  for (auto &channel : region->channels) {
+    uint32_t expected = shm_channel::FREE;
+    if (!channel.state.compare_exchange_strong(expected, shm_channel::SETUP,
+                                               std::memory_order_acquire))
+      continue;
+    channel.ip = ip;
+    channel.port = port;
+    channel.pid = getpid();
+    ++channel.generation;
+    channel.to_owner.reset();
+    channel.to_peer.reset();
+    channel.to_peer.max_len = frame_room(pool);
+    channel.state.store(shm_channel::CLAIMED, std::memory_order_release);
+    p.tx = &channel.to_owner;
+    p.rx = &channel.to_peer;
+    p.channel = &channel;
+    p.region = region;
+    attached[nattached++] = &p;
+    FASTT_LOG_DEBUG("Attached to shm region of %u %u\n", dip, dport);
+    return true;
+  }
+  unmap_region(region);
+  return false;
+}
+
+/* the owner of p's region is gone, its pkts go through inner until a new
+ * region is attached */
+void shm_backend::detach(peer &p) {
+  FASTT_LOG_DEBUG("Owner of shm region %u %u is gone\n", p.region->ip,
+                  p.region->port);
+  unmap_region(p.region);
+  p = peer{};
+}
+
+void shm_backend::check_liveness() {
+  for (auto &channel : own->channels)
+    if (channel.state.load(std::memory_order_acquire) ==
+            shm_channel::CLAIMED &&
+        !alive(channel.pid))
+      channel.state.store(shm_channel::FREE, std::memory_order_release);
+  for (uint16_t i = 0; i < nattached;) {
+    auto *p = attached[i];
+    if (std::atomic_ref(p->region->magic).load(std::memory_order_acquire) ==
+            shm_region::kMagic &&
+        alive(p->region->pid)) {
+      ++i;
+      continue;
+    }
+    detach(*p);
+    attached[i] = attached[--nattached];
+  }
+}
+
+shm_backend::peer *shm_backend::route(rte_mbuf *pkt) {
+  auto *ipv4 = rte_pktmbuf_mtod_offset(pkt, rte_ipv4_hdr *,
+                                       protocol::defs::kipOffset);
+  auto *udp =
+      rte_pktmbuf_mtod_offset(pkt, rte_udp_hdr *, protocol::defs::kudpOffset);
+  auto dport = rte_be_to_cpu_16(udp->dst_port);
+  auto [p, inserted] = peers.emplace(key(ipv4->dst_addr, dport));
+  if (!p)
+    return nullptr;
+  if (p->tx)
+    return p;
+  auto now = rte_get_timer_cycles();
+  if (!inserted && now < p->retry_at)
+    return nullptr;
+  if (attach(*p, ipv4->dst_addr, dport))
+    return p;
+  p->retry_at = now + kRetryMs * get_ticks_ms();
+  return nullptr;
+}
+
+uint16_t shm_backend::tx_burst(rte_mbuf **pkts, uint16_t cnt) {
+  std::array<peer *, kMaxBurst> route_to;
+  cnt = std::min(cnt, kMaxBurst);
+  for (uint16_t i = 0; i < cnt; ++i)
+    route_to[i] = route(pkts[i]);
+
+  uint16_t i = 0;
+  while (i < cnt) {
+    if (route_to[i]) {
+      /* a full ring is a drop like on the wire, waiting for a peer that
+       * may be gone would stall the scheduler */
+      if (!route_to[i]->tx->push(pkts[i]))
+        FASTT_LOG_DEBUG("Dropping pkt of size %u for shm\n", pkts[i]->pkt_len);
+      rte_pktmbuf_free(pkts[i++]);
+      continue;
+    }
+    auto j = i;
+    while (j < cnt && !route_to[j])
+      ++j;
+    if (!inner) {
+      rte_pktmbuf_free_bulk(pkts + i, j - i);
+      i = j;
+      continue;
+    }
+    auto sent = inner->tx_burst(pkts + i, j - i);
+    i += sent;
+    if (i < j)
+      return i;
+  }
+  return cnt;
+}
+
+uint16_t shm_backend::poll_rings(rte_mbuf **pkts, uint16_t cnt) {
+  uint16_t n = 0;
+  for (uint16_t i = 0; i < shm_region::kChannels; ++i) {
+    auto &channel = own->channels[i];
+    auto live = channel.state.load(std::memory_order_acquire) ==
+                shm_channel::CLAIMED;
+    auto &seen = known[i];
+    if (live != seen.live || (live && channel.generation != seen.generation)) {
+      /* the previous peer may have claimed another channel since */
+      if (auto *p = seen.live ? peers.lookup(seen.key) : nullptr;
+          p && p->channel == &channel)
+        *p = peer{};
+      seen.live = false;
+      if (live) {
+        auto k = key(channel.ip, channel.port);
+        if (auto *p = peers.emplace(k).first) {
+          p->tx = &channel.to_peer;
+          p->rx = &channel.to_owner;
+          p->channel = &channel;
+        }
+        seen = {true, channel.generation, k};
+      }
+    }
+    while (live && n < cnt) {
+      auto *pkt = channel.to_owner.pop(pool);
+      if (!pkt)
+        break;
+      pkts[n++] = pkt;
+    }
+  }
+  for (uint16_t i = 0; i < nattached && n < cnt; ++i) {
+    while (n < cnt) {
+      auto *pkt = attached[i]->rx->pop(pool);
+      if (!pkt)
+        break;
+      pkts[n++] = pkt;
+    }
+  }
+  return n;
+}
+
+uint16_t shm_backend::rx_burst(rte_mbuf **pkts, uint16_t cnt) {
+  if (auto now = rte_get_timer_cycles(); now >= next_check) {
+    check_liveness();
+    next_check = now + kLivenessMs * get_ticks_ms();
+  }
+  uint16_t n = inner ? inner->rx_burst(pkts, cnt) : 0;
+  return n + poll_rings(pkts + n, cnt - n);
+}